@@ -0,0 +1,252 @@
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <fasttrack.h>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+/* These benchmarks measure the scalability of the fasttrack variable table.
+ * Each benchmark thread accesses a private set of variables, hence there are
+ * no races and all costs are caused by the detector itself.
+ * Run with --benchmark_counters_tabular=true to get the scaling curve.
+ */
+
+using FasttrackDetector = drace::detector::Fasttrack<std::shared_mutex>;
+
+namespace {
+/// number of distinct variables accessed per thread
+constexpr size_t vars_per_thread = 4096;
+
+std::atomic<Detector::tid_t> next_tid{2};
+
+void noop_callback(const Detector::Race*, void*) {}
+
+/// one detector instance per shard configuration, shared by all threads
+FasttrackDetector& get_detector(int shards) {
+  static std::array<std::once_flag, 2> flags;
+  static std::array<std::unique_ptr<FasttrackDetector>, 2> detectors;
+  const int idx = (shards == 1) ? 0 : 1;
+  std::call_once(flags[idx], [&]() {
+    std::string num_shards = std::to_string(shards);
+    const char* argv[] = {"drace-bench", "--shards", num_shards.c_str()};
+    detectors[idx] = std::make_unique<FasttrackDetector>();
+    detectors[idx]->init(3, argv, noop_callback, nullptr);
+  });
+  return *detectors[idx];
+}
+}  // namespace
+
+static void FasttrackVarTableScaling(benchmark::State& state) {
+  FasttrackDetector& ft = get_detector(static_cast<int>(state.range(0)));
+  const Detector::tid_t tid = next_tid.fetch_add(1);
+  Detector::tls_t tls;
+  ft.fork(1, tid, &tls);
+
+  // private address range per thread
+  const uintptr_t base = static_cast<uintptr_t>(tid) << 32;
+  size_t i = 0;
+  for (auto _ : state) {
+    void* addr = reinterpret_cast<void*>(base + (i % vars_per_thread) * 8);
+    if (i & 1) {
+      ft.write(tls, (void*)0x1, addr, 8);
+    } else {
+      ft.read(tls, (void*)0x2, addr, 8);
+    }
+    ++i;
+  }
+  ft.finish(tls, tid);
+  state.SetItemsProcessed(state.iterations());
+}
+
+// single lock (pre-sharding behaviour) vs. default sharding
+BENCHMARK(FasttrackVarTableScaling)
+    ->ArgName("shards")
+    ->Arg(1)
+    ->Arg(VarTable::default_shards)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+/* Repeated accesses to a small working set, with a new epoch after each
+ * `epoch` accesses. Accesses in the same epoch are answered by the access
+ * cache of the thread, the others still save the variable lookup.
+ */
+static void FasttrackRepeatedAccess(benchmark::State& state) {
+  FasttrackDetector& ft = get_detector(VarTable::default_shards);
+  const Detector::tid_t tid = next_tid.fetch_add(1);
+  const auto epoch = static_cast<size_t>(state.range(0));
+  Detector::tls_t tls;
+  ft.fork(1, tid, &tls);
+
+  const uintptr_t base = static_cast<uintptr_t>(tid) << 32;
+  void* lock = reinterpret_cast<void*>(base);
+  size_t i = 0;
+  for (auto _ : state) {
+    void* addr = reinterpret_cast<void*>(base + (i % 64) * 8);
+    ft.write(tls, (void*)0x1, addr, 8);
+    if (++i % epoch == 0) {
+      ft.acquire(tls, lock, 1, true);
+      ft.release(tls, lock, true);
+    }
+  }
+  ft.finish(tls, tid);
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(FasttrackRepeatedAccess)->ArgName("epoch")->Range(64, 4096);
+
+/* Allocate a block, access a few words and free it again. The cost of the
+ * deallocation depends on the number of tracked words, not on the block size.
+ */
+static void FasttrackDeallocate(benchmark::State& state) {
+  FasttrackDetector& ft = get_detector(VarTable::default_shards);
+  const Detector::tid_t tid = next_tid.fetch_add(1);
+  const auto size = static_cast<size_t>(state.range(0));
+  Detector::tls_t tls;
+  ft.fork(1, tid, &tls);
+
+  const uintptr_t base = static_cast<uintptr_t>(tid) << 32;
+  for (auto _ : state) {
+    ft.allocate(tls, (void*)0x1, reinterpret_cast<void*>(base), size);
+    for (size_t i = 0; i < 16; ++i) {
+      ft.write(tls, (void*)0x2, reinterpret_cast<void*>(base + i * 64), 8);
+    }
+    ft.deallocate(tls, reinterpret_cast<void*>(base));
+  }
+  ft.finish(tls, tid);
+  state.SetBytesProcessed(state.iterations() * size);
+}
+
+BENCHMARK(FasttrackDeallocate)->ArgName("size")->Range(1 << 10, 1 << 20);
+
+/* Drop a table of many variables, as on finalize. The states are stored in
+ * pools, hence the costs depend on the number of arenas and the size of the
+ * index, but not on destructing each state.
+ */
+static void FasttrackVarTableClear(benchmark::State& state) {
+  const auto num_vars = static_cast<size_t>(state.range(0));
+  VarTable table;
+  for (auto _ : state) {
+    state.PauseTiming();
+    for (size_t i = 0; i < num_vars; ++i) {
+      table.get_or_create(0x10000000ull + i * 8);
+    }
+    state.ResumeTiming();
+    table.clear();
+  }
+  state.SetItemsProcessed(state.iterations() * num_vars);
+}
+
+BENCHMARK(FasttrackVarTableClear)
+    ->ArgName("vars")
+    ->Range(1 << 12, 1 << 20)
+    ->Unit(benchmark::kMicrosecond);
+
+/* Each thread acquires and releases its private mutex. As the mutex states
+ * have their own locks, this should scale with the number of threads.
+ */
+static void FasttrackPrivateLockScaling(benchmark::State& state) {
+  FasttrackDetector& ft = get_detector(VarTable::default_shards);
+  const Detector::tid_t tid = next_tid.fetch_add(1);
+  Detector::tls_t tls;
+  ft.fork(1, tid, &tls);
+
+  void* mutex = reinterpret_cast<void*>(static_cast<uintptr_t>(tid) << 32);
+  for (auto _ : state) {
+    ft.acquire(tls, mutex, 1, true);
+    ft.release(tls, mutex, true);
+  }
+  ft.finish(tls, tid);
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(FasttrackPrivateLockScaling)->ThreadRange(1, 64)->UseRealTime();
+
+/* Lock handoff between two threads of many: after all threads used the
+ * lock once, each sync operation only changes a few clock entries. Hence,
+ * tree clocks should not depend on the number of threads while dense vector
+ * clocks do.
+ */
+template <class ClockT>
+static void FasttrackLockHandoff(benchmark::State& state) {
+  using FtDetector = drace::detector::Fasttrack<std::mutex, ClockT>;
+  const auto num_threads = static_cast<Detector::tid_t>(state.range(0));
+  FtDetector ft;
+  const char* argv[] = {"drace-bench"};
+  ft.init(1, argv, noop_callback, nullptr);
+
+  std::vector<Detector::tls_t> tls(num_threads);
+  for (Detector::tid_t t = 0; t < num_threads; ++t) {
+    ft.fork(1, t + 2, &tls[t]);
+  }
+  void* mutex = reinterpret_cast<void*>(0x1000);
+  for (auto t : tls) {
+    ft.acquire(t, mutex, 1, true);
+    ft.release(t, mutex, true);
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    auto t = tls[i++ & 1];
+    ft.acquire(t, mutex, 1, true);
+    ft.release(t, mutex, true);
+  }
+  ft.finalize();
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(FasttrackLockHandoff, VectorClock<>)
+    ->ArgName("threads")
+    ->RangeMultiplier(4)
+    ->Range(4, 1024);
+BENCHMARK_TEMPLATE(FasttrackLockHandoff, TreeClock)
+    ->ArgName("threads")
+    ->RangeMultiplier(4)
+    ->Range(4, 1024);
+
+/* Read-shared race check of a write to a variable which was read by many
+ * threads, using the kernels of each instruction set.
+ */
+static void FasttrackReadSharedCheck(benchmark::State& state) {
+  using VC = VectorClock<>;
+  const auto num_readers = static_cast<VC::TID>(state.range(0));
+  const auto isa = static_cast<vectorops::Isa>(state.range(1));
+  if (!vectorops::set_isa(isa)) {
+    state.SkipWithError("instruction set not supported");
+    return;
+  }
+
+  ReadSharedTable shared;
+  VarState var;
+  var.update(false, VC::make_id(1) + 1);
+  var.set_read_shared(shared, VC::make_id(2) + 1);
+  for (VC::TID t = 3; t <= num_readers; ++t) {
+    var.update(false, VC::make_id(t) + 1);
+  }
+  // the writer knows all reads, hence the whole set is scanned
+  ThreadState writer(num_readers + 1);
+  for (VC::TID t = 1; t <= num_readers; ++t) {
+    writer.update(t, VC::make_id(t) + 2);
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(var.is_rw_sh_race(&writer));
+  }
+  vectorops::set_isa(vectorops::detect_isa());
+  state.SetItemsProcessed(state.iterations() * num_readers);
+}
+
+BENCHMARK(FasttrackReadSharedCheck)
+    ->ArgNames({"readers", "isa"})
+    ->ArgsProduct({{4, 16, 64, 256, 1024}, {0, 1, 2}});
@@ -0,0 +1,628 @@
+#pragma once
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "ExtsanData.h"
+
+namespace ipc {
+/**
+ * \brief Compact trace format of the TraceBinary detector
+ *
+ * A trace starts with a \ref FileHeader, followed by blocks. Each block
+ * holds the events of a single thread (stream) and starts with a
+ * \ref BlockHeader. The header sizes are stored in the file header, hence
+ * later versions can extend them.
+ *
+ * Events are encoded as a tag byte (type and flags) followed by varints.
+ * Program counters and addresses are stored as zig-zag encoded deltas to
+ * the previous value of the stream. The delta state is reset at each block,
+ * hence blocks can be decoded independently.
+ *
+ * Synchronization events (see \ref has_seq) additionally carry a global
+ * sequence number. Memory accesses are only ordered within their stream,
+ * which is sufficient for happens-before based detectors. The
+ * \ref TraceReader merges the streams accordingly.
+ *
+ * The legacy format (plain \ref event::BufferEntry records) has no file
+ * header, see \ref is_trace.
+ */
+namespace trace {
+
+constexpr char magic[8] = {'D', 'R', 'T', 'R', 'A', 'C', 'E', '\0'};
+constexpr uint16_t version = 1;
+
+struct FileHeader {
+  char magic[8];
+  uint16_t version;
+  /// size of this header
+  uint16_t header_size;
+  /// size of each block header
+  uint16_t block_header_size;
+  /// pointer size of the traced application (informational)
+  uint8_t pointer_size;
+  uint8_t reserved;
+};
+static_assert(sizeof(FileHeader) == 16, "unexpected padding");
+
+struct BlockHeader {
+  /// thread id of the events in the block
+  uint32_t stream;
+  uint32_t num_events;
+  /// size of the payload in bytes
+  uint32_t size;
+  /// number of the block within its stream, to restore the order of the
+  /// blocks if they are written concurrently
+  uint32_t index;
+  /// sequence number the deltas of the block are based on
+  uint64_t base_seq;
+};
+static_assert(sizeof(BlockHeader) == 24, "unexpected padding");
+
+/// maximum size of an encoded event
+constexpr size_t max_event_size = 64;
+
+// layout of the tag byte
+constexpr uint8_t type_mask = 0x0F;
+/// memory access: log2 of the access size (if not raw)
+constexpr unsigned size_shift = 4;
+/// memory access: size is stored as varint
+constexpr uint8_t flag_raw_size = 0x40;
+/// memory access: same pc as the previous event
+constexpr uint8_t flag_same_pc = 0x80;
+/// mutex: write (exclusive) lock
+constexpr uint8_t flag_write = 0x10;
+
+/// true if events of this type carry a global sequence number
+constexpr bool has_seq(event::Type type) {
+  return type != event::Type::MEMREAD && type != event::Type::MEMWRITE &&
+         type != event::Type::FUNCENTER && type != event::Type::FUNCEXIT &&
+         type != event::Type::NONE;
+}
+
+/// thread whose stream an event belongs to
+inline uint32_t stream_of(const event::BufferEntry& e) {
+  switch (e.type) {
+    case event::Type::MEMREAD:
+    case event::Type::MEMWRITE:
+      return e.payload.memaccess.thread_id;
+    case event::Type::ACQUIRE:
+    case event::Type::RELEASE:
+      return e.payload.mutex.thread_id;
+    case event::Type::HAPPENSBEFORE:
+    case event::Type::HAPPENSAFTER:
+      return e.payload.happens.thread_id;
+    case event::Type::ALLOCATION:
+    case event::Type::FREE:
+      return e.payload.allocation.thread_id;
+    case event::Type::FORK:
+      return e.payload.forkjoin.child;
+    case event::Type::JOIN:
+      return e.payload.forkjoin.parent;
+    case event::Type::DETACH:
+    case event::Type::FINISH:
+      return e.payload.detachfinish.thread_id;
+    case event::Type::FUNCENTER:
+      return e.payload.funcenter.thread_id;
+    case event::Type::FUNCEXIT:
+      return e.payload.funcexit.thread_id;
+    default:
+      return 0;
+  }
+}
+
+inline void put_varint(uint8_t*& out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  *out++ = static_cast<uint8_t>(value);
+}
+
+/// \throws std::runtime_error if the varint exceeds the buffer
+inline uint64_t get_varint(const uint8_t*& in, const uint8_t* end) {
+  uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (in == end) break;
+    const uint8_t byte = *in++;
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) return value;
+  }
+  throw std::runtime_error("corrupt trace: truncated varint");
+}
+
+/// stores the zig-zag encoded difference of value and *last
+inline void put_delta(uint8_t*& out, uint64_t value, uint64_t* last) {
+  const int64_t diff = static_cast<int64_t>(value - *last);
+  *last = value;
+  put_varint(out, (static_cast<uint64_t>(diff) << 1) ^
+                      static_cast<uint64_t>(diff >> 63));
+}
+
+inline uint64_t get_delta(const uint8_t*& in, const uint8_t* end,
+                          uint64_t* last) {
+  const uint64_t zz = get_varint(in, end);
+  *last += (zz >> 1) ^ (~(zz & 1) + 1);
+  return *last;
+}
+
+/// log2 of the common access sizes 1, 2, 4 and 8, otherwise -1
+constexpr int size_log2(uint64_t size) {
+  return size == 1 ? 0 : size == 2 ? 1 : size == 4 ? 2 : size == 8 ? 3 : -1;
+}
+
+/// last values of a stream, the deltas are based on
+struct DeltaState {
+  uint64_t pc{0};
+  uint64_t addr{0};
+  /// last mutex or happens-before identifier
+  uint64_t sync{0};
+  uint64_t seq{0};
+};
+
+inline FileHeader make_file_header() {
+  FileHeader header{};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.header_size = sizeof(FileHeader);
+  header.block_header_size = sizeof(BlockHeader);
+  header.pointer_size = sizeof(void*);
+  return header;
+}
+
+/// true if the data starts with a file header (otherwise legacy format)
+inline bool is_trace(const uint8_t* data, size_t size) {
+  return size >= sizeof(magic) && std::memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+/**
+ * \brief Encodes the events of one thread into blocks
+ *
+ * The block header is stored in front of the payload, hence a block is
+ * written with a single call (see \ref data).
+ *
+ * \note Not Threadsafe
+ */
+class StreamEncoder {
+ public:
+  static constexpr size_t default_block_size = 1 << 16;
+
+ private:
+  BlockHeader _header{};
+  DeltaState _state;
+  size_t _block_size;
+  /// block header followed by the payload
+  std::unique_ptr<uint8_t[]> _block;
+  uint8_t* _payload;
+  uint8_t* _pos;
+
+ public:
+  explicit StreamEncoder(uint32_t stream,
+                         size_t block_size = default_block_size)
+      : _block_size(block_size),
+        _block(new uint8_t[sizeof(BlockHeader) + block_size +
+                           max_event_size]),
+        _payload(_block.get() + sizeof(BlockHeader)),
+        _pos(_payload) {
+    _header.stream = stream;
+  }
+
+  /**
+   * \brief appends an event to the current block
+   * \param seq global sequence number, only stored if \ref has_seq
+   * \note the thread ids of the event are implied by the stream, except
+   *       for fork and join
+   */
+  void add(const event::BufferEntry& e, uint64_t seq) {
+    uint8_t* out = _pos;
+    uint8_t* tag = out++;
+    *tag = static_cast<uint8_t>(e.type);
+    if (has_seq(e.type)) {
+      put_varint(out, seq - _state.seq);
+      _state.seq = seq;
+    }
+    switch (e.type) {
+      case event::Type::MEMREAD:
+      case event::Type::MEMWRITE: {
+        const auto& m = e.payload.memaccess;
+        if (m.pc == _state.pc) {
+          *tag |= flag_same_pc;
+        } else {
+          put_delta(out, m.pc, &_state.pc);
+        }
+        put_delta(out, m.addr, &_state.addr);
+        const int log2 = size_log2(m.size);
+        if (log2 >= 0) {
+          *tag |= static_cast<uint8_t>(log2 << size_shift);
+        } else {
+          *tag |= flag_raw_size;
+          put_varint(out, m.size);
+        }
+        break;
+      }
+      case event::Type::ACQUIRE:
+      case event::Type::RELEASE: {
+        const auto& m = e.payload.mutex;
+        if (m.write) *tag |= flag_write;
+        put_delta(out, m.addr, &_state.sync);
+        if (e.type == event::Type::ACQUIRE) {
+          put_varint(out, static_cast<uint32_t>(m.recursive));
+        }
+        break;
+      }
+      case event::Type::HAPPENSBEFORE:
+      case event::Type::HAPPENSAFTER:
+        put_delta(out, e.payload.happens.id, &_state.sync);
+        break;
+      case event::Type::ALLOCATION:
+        put_delta(out, e.payload.allocation.pc, &_state.pc);
+        put_delta(out, e.payload.allocation.addr, &_state.addr);
+        put_varint(out, e.payload.allocation.size);
+        break;
+      case event::Type::FREE:
+        put_delta(out, e.payload.allocation.addr, &_state.addr);
+        break;
+      case event::Type::FORK:
+      case event::Type::JOIN:
+        put_varint(out, e.payload.forkjoin.parent);
+        put_varint(out, e.payload.forkjoin.child);
+        break;
+      case event::Type::FUNCENTER:
+        put_delta(out, e.payload.funcenter.pc, &_state.pc);
+        break;
+      default:
+        break;
+    }
+    _pos = out;
+    ++_header.num_events;
+  }
+
+  /// true if the block should be written
+  bool full() const {
+    return static_cast<size_t>(_pos - _payload) >= _block_size;
+  }
+
+  bool empty() const { return _header.num_events == 0; }
+
+  /// header of the current block
+  const BlockHeader& header() {
+    _header.size = static_cast<uint32_t>(_pos - _payload);
+    return _header;
+  }
+
+  const uint8_t* payload() const { return _payload; }
+
+  /// the current block (header and payload), see \ref size
+  const uint8_t* data() {
+    std::memcpy(_block.get(), &header(), sizeof(BlockHeader));
+    return _block.get();
+  }
+
+  /// size of the current block including its header
+  size_t size() const { return sizeof(BlockHeader) + (_pos - _payload); }
+
+  /// start a new block, after the current one has been written
+  void next_block() {
+    const uint64_t seq = _state.seq;
+    _state = DeltaState();
+    _state.seq = _header.base_seq = seq;
+    _header.num_events = 0;
+    _header.size = 0;
+    ++_header.index;
+    _pos = _payload;
+  }
+};
+
+/**
+ * \brief Decodes the events of a single block
+ */
+class BlockDecoder {
+  const uint8_t* _pos{nullptr};
+  const uint8_t* _end{nullptr};
+  uint32_t _stream{0};
+  uint32_t _left{0};
+  DeltaState _state;
+
+ public:
+  BlockDecoder() = default;
+  BlockDecoder(const BlockHeader& header, const uint8_t* payload)
+      : _pos(payload),
+        _end(payload + header.size),
+        _stream(header.stream),
+        _left(header.num_events) {
+    _state.seq = header.base_seq;
+  }
+
+  bool done() const { return _left == 0; }
+
+  /**
+   * \brief decodes the next event
+   * \return true if the event has a sequence number, which is stored in seq
+   * \throws std::runtime_error if the block is corrupt
+   */
+  bool next(event::BufferEntry* e, uint64_t* seq) {
+    if (_left == 0 || _pos == _end) {
+      throw std::runtime_error("corrupt trace: block too short");
+    }
+    --_left;
+    const uint8_t tag = *_pos++;
+    const auto type = static_cast<event::Type>(tag & type_mask);
+    e->type = type;
+    const bool sync = has_seq(type);
+    if (sync) {
+      *seq = (_state.seq += get_varint(_pos, _end));
+    }
+    switch (type) {
+      case event::Type::MEMREAD:
+      case event::Type::MEMWRITE: {
+        auto& m = e->payload.memaccess;
+        m.thread_id = _stream;
+        if ((tag & flag_same_pc) == 0) get_delta(_pos, _end, &_state.pc);
+        m.pc = static_cast<uintptr_t>(_state.pc);
+        m.addr = static_cast<uintptr_t>(get_delta(_pos, _end, &_state.addr));
+        m.size = (tag & flag_raw_size)
+                     ? static_cast<uintptr_t>(get_varint(_pos, _end))
+                     : uintptr_t(1) << ((tag >> size_shift) & 0x3);
+        break;
+      }
+      case event::Type::ACQUIRE:
+      case event::Type::RELEASE: {
+        auto& m = e->payload.mutex;
+        m.thread_id = _stream;
+        m.addr = static_cast<uintptr_t>(get_delta(_pos, _end, &_state.sync));
+        m.write = (tag & flag_write) != 0;
+        m.acquire = (type == event::Type::ACQUIRE);
+        m.recursive =
+            m.acquire ? static_cast<int>(get_varint(_pos, _end)) : 0;
+        break;
+      }
+      case event::Type::HAPPENSBEFORE:
+      case event::Type::HAPPENSAFTER:
+        e->payload.happens.thread_id = _stream;
+        e->payload.happens.id =
+            static_cast<uintptr_t>(get_delta(_pos, _end, &_state.sync));
+        break;
+      case event::Type::ALLOCATION: {
+        auto& a = e->payload.allocation;
+        a.thread_id = _stream;
+        a.pc = static_cast<uintptr_t>(get_delta(_pos, _end, &_state.pc));
+        a.addr = static_cast<uintptr_t>(get_delta(_pos, _end, &_state.addr));
+        a.size = static_cast<uintptr_t>(get_varint(_pos, _end));
+        break;
+      }
+      case event::Type::FREE: {
+        auto& a = e->payload.allocation;
+        a.thread_id = _stream;
+        a.pc = 0;
+        a.addr = static_cast<uintptr_t>(get_delta(_pos, _end, &_state.addr));
+        a.size = 0;
+        break;
+      }
+      case event::Type::FORK:
+      case event::Type::JOIN:
+        e->payload.forkjoin.parent =
+            static_cast<uint32_t>(get_varint(_pos, _end));
+        e->payload.forkjoin.child =
+            static_cast<uint32_t>(get_varint(_pos, _end));
+        break;
+      case event::Type::DETACH:
+      case event::Type::FINISH:
+        e->payload.detachfinish.thread_id = _stream;
+        break;
+      case event::Type::FUNCENTER:
+        e->payload.funcenter.thread_id = _stream;
+        e->payload.funcenter.pc =
+            static_cast<uintptr_t>(get_delta(_pos, _end, &_state.pc));
+        break;
+      case event::Type::FUNCEXIT:
+        e->payload.funcexit.thread_id = _stream;
+        break;
+      default:
+        throw std::runtime_error("corrupt trace: unknown event type");
+    }
+    return sync;
+  }
+};
+
+/**
+ * \brief Reads a trace and merges its streams
+ *
+ * The events of each stream are returned in order. Streams are switched at
+ * synchronization events only, which are returned in the order of their
+ * sequence numbers. The memory accesses between two synchronization events
+ * of a thread are returned right after the first of them.
+ *
+ * \note the data must stay valid while the reader is used
+ */
+class TraceReader {
+ public:
+  /// called with a range of the data which is not read anymore
+  using ReleaseFn = std::function<void(size_t begin, size_t end)>;
+  /// granularity in which consumed data is released
+  static constexpr size_t release_bytes = 1 << 24;
+
+ private:
+  struct Stream {
+    /// (index, offset) of the blocks of this stream
+    std::vector<std::pair<uint32_t, size_t>> blocks;
+    /// smallest offset of the blocks from i on
+    std::vector<size_t> min_offset;
+    size_t next_block{0};
+    BlockDecoder decoder;
+    /// next synchronization event, which waits for its turn
+    event::BufferEntry pending;
+  };
+
+  const uint8_t* _data;
+  size_t _size;
+  size_t _header_size;
+  ReleaseFn _release;
+  /// end of the released range
+  size_t _released{0};
+  std::vector<Stream> _streams;
+  /// (sequence number, stream) of the pending events
+  std::priority_queue<std::pair<uint64_t, size_t>,
+                      std::vector<std::pair<uint64_t, size_t>>,
+                      std::greater<std::pair<uint64_t, size_t>>>
+      _order;
+  /// stream which returns its events until the next synchronization event
+  size_t _current;
+  /// streams which did not return their first events yet
+  size_t _startup{0};
+
+  /// blocks are not aligned in the file, hence the header is copied
+  BlockHeader block_header(size_t offset) const {
+    BlockHeader header;
+    std::memcpy(&header, _data + offset, sizeof(header));
+    return header;
+  }
+
+  /// \return false if the stream has no more events
+  bool advance(Stream& s) {
+    while (s.decoder.done()) {
+      if (s.next_block == s.blocks.size()) return false;
+      const size_t offset = s.blocks[s.next_block++].second;
+      s.decoder = BlockDecoder(block_header(offset),
+                               _data + offset + _header_size);
+      if (_release) {
+        const size_t end = consumed();
+        if (end - _released >= release_bytes) {
+          _release(_released, end);
+          _released = end;
+        }
+      }
+    }
+    return true;
+  }
+
+ public:
+  /**
+   * \param release if set, it is called with the ranges of the data which
+   *        are not read anymore, e.g. to drop them from a memory mapping
+   * \throws std::runtime_error if the data is not a valid trace
+   */
+  TraceReader(const uint8_t* data, size_t size, ReleaseFn release = nullptr)
+      : _data(data), _size(size), _release(std::move(release)) {
+    if (!is_trace(data, size) || size < sizeof(FileHeader)) {
+      throw std::runtime_error("not a trace file");
+    }
+    FileHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.version > version || header.header_size < sizeof(FileHeader) ||
+        header.block_header_size < sizeof(BlockHeader)) {
+      throw std::runtime_error("unsupported trace version");
+    }
+    _header_size = header.block_header_size;
+
+    // index the blocks of each stream
+    std::unordered_map<uint32_t, size_t> ids;
+    for (size_t offset = header.header_size; offset < size;) {
+      if (size - offset < _header_size) {
+        throw std::runtime_error("corrupt trace: truncated block header");
+      }
+      BlockHeader block;
+      std::memcpy(&block, data + offset, sizeof(block));
+      if (size - offset - _header_size < block.size) {
+        throw std::runtime_error("corrupt trace: truncated block");
+      }
+      auto id = ids.emplace(block.stream, _streams.size());
+      if (id.second) {
+        _streams.emplace_back();
+      }
+      _streams[id.first->second].blocks.emplace_back(block.index, offset);
+      offset += _header_size + block.size;
+      if (_release && offset - _released >= release_bytes) {
+        _release(_released, offset);
+        _released = offset;
+      }
+    }
+    if (_release) {
+      // the indexed headers are read again with the blocks
+      _release(_released, size);
+      _released = 0;
+    }
+    for (auto& stream : _streams) {
+      std::stable_sort(stream.blocks.begin(), stream.blocks.end());
+      stream.min_offset.resize(stream.blocks.size());
+      size_t low = size;
+      for (size_t i = stream.blocks.size(); i-- > 0;) {
+        low = std::min(low, stream.blocks[i].second);
+        stream.min_offset[i] = low;
+      }
+    }
+    _current = _streams.size();
+  }
+
+  /// number of threads in the trace
+  size_t num_streams() const { return _streams.size(); }
+
+  /**
+   * \brief offset in the data below which no block is read anymore
+   *
+   * Lets the caller drop the consumed part of a mapped trace. The result
+   * only grows while the trace is read.
+   */
+  size_t consumed() const {
+    size_t low = _size;
+    for (const Stream& s : _streams) {
+      // the current block is still read if it has events left
+      const size_t first = s.decoder.done() ? s.next_block : s.next_block - 1;
+      if (first < s.blocks.size()) {
+        low = std::min(low, s.min_offset[first]);
+      }
+    }
+    return low;
+  }
+
+  /**
+   * \brief returns the next event
+   * \return false if all events have been read
+   * \throws std::runtime_error if the trace is corrupt
+   */
+  bool next(event::BufferEntry* e) {
+    while (true) {
+      if (_current == _streams.size()) {
+        if (_startup < _streams.size()) {
+          _current = _startup++;
+        } else if (!_order.empty()) {
+          _current = _order.top().second;
+          _order.pop();
+          *e = _streams[_current].pending;
+          return true;
+        } else {
+          return false;
+        }
+      }
+      Stream& s = _streams[_current];
+      if (!advance(s)) {
+        _current = _streams.size();
+        continue;
+      }
+      uint64_t seq;
+      if (!s.decoder.next(e, &seq)) {
+        return true;
+      }
+      s.pending = *e;
+      _order.emplace(seq, _current);
+      _current = _streams.size();
+    }
+  }
+};
+
+}  // namespace trace
+}  // namespace ipc
@@ -0,0 +1,41 @@
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gtest/gtest.h"
+
+#include "util/MappedFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+TEST(MappedFile, ReadAndRelease) {
+  const char* filename = "mapped_file_test.bin";
+  std::vector<uint8_t> content(1 << 20);
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<uint8_t>(i * 7);
+  }
+  {
+    std::ofstream out(filename, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(content.data()), content.size());
+  }
+  {
+    util::MappedFile file(filename);
+    ASSERT_EQ(file.size(), content.size());
+    EXPECT_EQ(0, std::memcmp(file.data(), content.data(), content.size()));
+
+    // released pages are loaded again
+    file.release(100, content.size() / 2);
+    file.release(0, content.size());
+    EXPECT_EQ(0, std::memcmp(file.data(), content.data(), content.size()));
+  }
+  std::remove(filename);
+
+  EXPECT_THROW(util::MappedFile("does_not_exist.bin"), std::runtime_error);
+}
@@ -0,0 +1,226 @@
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "gtest/gtest.h"
+
+#include "ipc/TraceFormat.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace ipc;
+
+namespace {
+event::BufferEntry access(uint32_t tid, uintptr_t pc, uintptr_t addr,
+                          uintptr_t size, bool write) {
+  event::BufferEntry e{};
+  e.type = write ? event::Type::MEMWRITE : event::Type::MEMREAD;
+  e.payload.memaccess = {tid, pc, addr, size};
+  return e;
+}
+
+event::BufferEntry mutex(uint32_t tid, uintptr_t addr, bool acquire) {
+  event::BufferEntry e{};
+  e.type = acquire ? event::Type::ACQUIRE : event::Type::RELEASE;
+  e.payload.mutex = {tid, addr, acquire ? 1 : 0, true, acquire};
+  return e;
+}
+
+/**
+ * write a trace of the events (in this global order) with small blocks
+ * \param reverse write the blocks in reverse order, as concurrent writers
+ *        may reorder them in the file
+ */
+std::vector<uint8_t> encode(const std::vector<event::BufferEntry>& events,
+                            size_t block_size, bool reverse = false) {
+  std::vector<std::vector<uint8_t>> blocks;
+  std::unordered_map<uint32_t, trace::StreamEncoder> streams;
+  auto write_block = [&blocks](trace::StreamEncoder& enc) {
+    blocks.emplace_back(enc.data(), enc.data() + enc.size());
+    enc.next_block();
+  };
+  uint64_t seq = 0;
+  for (const auto& e : events) {
+    const uint32_t tid = trace::stream_of(e);
+    auto& enc = streams.try_emplace(tid, tid, block_size).first->second;
+    enc.add(e, trace::has_seq(e.type) ? ++seq : 0);
+    if (enc.full()) write_block(enc);
+  }
+  for (auto& s : streams) {
+    if (!s.second.empty()) write_block(s.second);
+  }
+  if (reverse) {
+    std::reverse(blocks.begin(), blocks.end());
+  }
+  const trace::FileHeader header = trace::make_file_header();
+  std::vector<uint8_t> out((const uint8_t*)&header,
+                           (const uint8_t*)&header + sizeof(header));
+  for (const auto& block : blocks) {
+    out.insert(out.end(), block.begin(), block.end());
+  }
+  return out;
+}
+
+std::vector<event::BufferEntry> decode(const std::vector<uint8_t>& data) {
+  trace::TraceReader reader(data.data(), data.size());
+  std::vector<event::BufferEntry> decoded;
+  event::BufferEntry e;
+  while (reader.next(&e)) {
+    decoded.push_back(e);
+  }
+  return decoded;
+}
+}  // namespace
+
+TEST(TraceFormat, Varint) {
+  uint8_t buf[32];
+  for (uint64_t v : {0ull, 1ull, 127ull, 128ull, 300ull, ~0ull}) {
+    uint8_t* out = buf;
+    trace::put_varint(out, v);
+    const uint8_t* in = buf;
+    EXPECT_EQ(trace::get_varint(in, out), v);
+    EXPECT_EQ(in, out);
+  }
+  uint64_t last = 0x1000, decoded = 0x1000;
+  uint8_t* out = buf;
+  trace::put_delta(out, 0xFF8, &last);
+  EXPECT_EQ(out - buf, 1);  // small negative delta
+  const uint8_t* in = buf;
+  EXPECT_EQ(trace::get_delta(in, out, &decoded), 0xFF8u);
+
+  // truncated
+  buf[0] = 0x80;
+  in = buf;
+  EXPECT_THROW(trace::get_varint(in, buf + 1), std::runtime_error);
+}
+
+TEST(TraceFormat, RoundTrip) {
+  std::vector<event::BufferEntry> events;
+  event::BufferEntry fork{};
+  fork.type = event::Type::FORK;
+  fork.payload.forkjoin = {1, 2};
+  events.push_back(fork);
+  for (uint32_t i = 0; i < 1000; ++i) {
+    const uint32_t tid = 1 + (i / 10) % 2;
+    events.push_back(access(tid, 0x400000 + (i % 3) * 4, 0x7f0000 + i * 8,
+                            (i % 7 == 0) ? 16 : 8, i % 2 == 0));
+    if (i % 10 == 9) {
+      events.push_back(mutex(tid, 0x5000, true));
+      events.push_back(mutex(tid, 0x5000, false));
+    }
+  }
+  event::BufferEntry join{};
+  join.type = event::Type::JOIN;
+  join.payload.forkjoin = {1, 2};
+  events.push_back(join);
+
+  const auto data = encode(events, 256);
+  ASSERT_TRUE(trace::is_trace(data.data(), data.size()));
+  // far less than the legacy records
+  EXPECT_LT(data.size() * 5, events.size() * sizeof(event::BufferEntry));
+
+  trace::TraceReader reader(data.data(), data.size());
+  EXPECT_EQ(reader.num_streams(), 2);
+  // events of each thread keep their order, sync events the global order
+  std::vector<event::BufferEntry> decoded;
+  event::BufferEntry e;
+  while (reader.next(&e)) {
+    decoded.push_back(e);
+  }
+  ASSERT_EQ(decoded.size(), events.size());
+  for (uint32_t tid : {1u, 2u}) {
+    std::vector<const event::BufferEntry*> expected, actual;
+    for (const auto& ev : events) {
+      if (trace::stream_of(ev) == tid) expected.push_back(&ev);
+    }
+    for (const auto& ev : decoded) {
+      if (trace::stream_of(ev) == tid) actual.push_back(&ev);
+    }
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ASSERT_EQ(expected[i]->type, actual[i]->type);
+      if (expected[i]->type == event::Type::MEMREAD ||
+          expected[i]->type == event::Type::MEMWRITE) {
+        const auto& a = expected[i]->payload.memaccess;
+        const auto& b = actual[i]->payload.memaccess;
+        EXPECT_EQ(a.pc, b.pc);
+        EXPECT_EQ(a.addr, b.addr);
+        EXPECT_EQ(a.size, b.size);
+      }
+    }
+  }
+  std::vector<event::Type> sync_expected, sync_actual;
+  for (const auto& ev : events) {
+    if (trace::has_seq(ev.type)) sync_expected.push_back(ev.type);
+  }
+  for (const auto& ev : decoded) {
+    if (trace::has_seq(ev.type)) sync_actual.push_back(ev.type);
+  }
+  EXPECT_EQ(sync_expected, sync_actual);
+  EXPECT_EQ(decoded.back().type, event::Type::JOIN);
+  EXPECT_EQ(decoded.back().payload.forkjoin.child, 2u);
+}
+
+TEST(TraceFormat, Corrupt) {
+  std::vector<uint8_t> legacy(sizeof(event::BufferEntry) * 4, 0);
+  EXPECT_FALSE(trace::is_trace(legacy.data(), legacy.size()));
+  EXPECT_THROW(trace::TraceReader(legacy.data(), legacy.size()),
+               std::runtime_error);
+
+  auto data = encode({access(1, 0x1, 0x2, 4, true)}, 256);
+  data.pop_back();
+  EXPECT_THROW(trace::TraceReader(data.data(), data.size()),
+               std::runtime_error);
+}
+
+TEST(TraceFormat, BlocksOutOfOrder) {
+  std::vector<event::BufferEntry> events;
+  for (uint32_t i = 0; i < 500; ++i) {
+    const uint32_t tid = 1 + i % 3;
+    events.push_back(access(tid, 0x400000, 0x7f0000 + i * 8, 8, false));
+    if (i % 20 == 0) {
+      events.push_back(mutex(tid, 0x5000, true));
+      events.push_back(mutex(tid, 0x5000, false));
+    }
+  }
+  const auto ordered = decode(encode(events, 64));
+  const auto reversed = decode(encode(events, 64, true));
+  ASSERT_EQ(ordered.size(), events.size());
+  ASSERT_EQ(ordered.size(), reversed.size());
+  for (size_t i = 0; i < ordered.size(); ++i) {
+    ASSERT_EQ(ordered[i].type, reversed[i].type);
+    if (ordered[i].type == event::Type::MEMREAD) {
+      ASSERT_EQ(ordered[i].payload.memaccess.addr,
+                reversed[i].payload.memaccess.addr);
+    }
+  }
+}
+
+TEST(TraceFormat, Release) {
+  std::vector<event::BufferEntry> events;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    events.push_back(access(1 + i % 2, 0x400000, 0x7f0000 + i * 8, 8, true));
+  }
+  const auto data = encode(events, 64);
+  std::vector<std::pair<size_t, size_t>> released;
+  trace::TraceReader reader(data.data(), data.size(),
+                            [&released](size_t begin, size_t end) {
+                              released.emplace_back(begin, end);
+                            });
+  // the pages touched by the index are released
+  ASSERT_FALSE(released.empty());
+  EXPECT_EQ(released.back().second, data.size());
+
+  size_t num = 0;
+  event::BufferEntry e;
+  while (reader.next(&e)) {
+    ++num;
+  }
+  EXPECT_EQ(num, events.size());
+  EXPECT_EQ(reader.consumed(), data.size());
+}
@@ -0,0 +1,145 @@
+#pragma once
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace util {
+/**
+ * \brief Read-only memory mapping of a whole file
+ *
+ * The pages are only loaded when they are accessed. Pages which are not
+ * needed anymore can be dropped with \ref release, hence a file can be
+ * read sequentially with a constant amount of memory, even if it is
+ * larger than the physical memory.
+ */
+class MappedFile {
+  const uint8_t* _data{nullptr};
+  size_t _size{0};
+#ifdef WIN32
+  HANDLE _file{INVALID_HANDLE_VALUE};
+  HANDLE _mapping{NULL};
+#endif
+
+  static size_t page_size() {
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwAllocationGranularity;
+#else
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+  }
+
+ public:
+  /// \throws std::runtime_error if the file cannot be mapped
+  explicit MappedFile(const std::string& filename) {
+#ifdef WIN32
+    _file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER size;
+    if (_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(_file, &size)) {
+      close();
+      throw std::runtime_error("could not open file: " + filename);
+    }
+    _size = static_cast<size_t>(size.QuadPart);
+    if (_size == 0) return;
+    _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (_mapping != NULL) {
+      _data = static_cast<const uint8_t*>(
+          MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+#else
+    const int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      if (fd >= 0) ::close(fd);
+      throw std::runtime_error("could not open file: " + filename);
+    }
+    _size = static_cast<size_t>(st.st_size);
+    if (_size == 0) {
+      ::close(fd);
+      return;
+    }
+    void* addr = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file open
+    ::close(fd);
+    if (addr != MAP_FAILED) {
+      _data = static_cast<const uint8_t*>(addr);
+    }
+#endif
+    if (_data == nullptr) {
+      close();
+      throw std::runtime_error("could not map file: " + filename);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() { close(); }
+
+  const uint8_t* data() const { return _data; }
+  size_t size() const { return _size; }
+
+  /// hint that the file is read front to back
+  void advise_sequential() {
+#ifndef WIN32
+    if (_data != nullptr) {
+      madvise(const_cast<uint8_t*>(_data), _size, MADV_SEQUENTIAL);
+    }
+#endif
+  }
+
+  /**
+   * \brief drops the loaded pages of [begin, end) from memory
+   *
+   * The page of begin is dropped as well, the page of end is kept. The data
+   * stays valid, the pages are loaded again if they are accessed.
+   */
+  void release(size_t begin, size_t end) {
+    const size_t mask = page_size() - 1;
+    begin &= ~mask;
+    end = (end < _size ? end : _size) & ~mask;
+    if (_data == nullptr || end <= begin) return;
+    void* addr = const_cast<uint8_t*>(_data + begin);
+#ifdef WIN32
+    // removes the (unlocked) pages from the working set
+    VirtualUnlock(addr, end - begin);
+#else
+    madvise(addr, end - begin, MADV_DONTNEED);
+#endif
+  }
+
+ private:
+  void close() {
+#ifdef WIN32
+    if (_data != nullptr) UnmapViewOfFile(_data);
+    if (_mapping != NULL) CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+    _mapping = NULL;
+    _file = INVALID_HANDLE_VALUE;
+#else
+    if (_data != nullptr) munmap(const_cast<uint8_t*>(_data), _size);
+#endif
+    _data = nullptr;
+  }
+};
+}  // namespace util
@@ -0,0 +1,144 @@
+#pragma once
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <array>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace util {
+/**
+ * \brief Size-class slab allocator for small metadata objects
+ *
+ * Objects of up to \ref max_size bytes are carved from arenas of ArenaSize
+ * bytes. Freed objects are kept in a free list per size class (multiples of
+ * \ref granularity) and reused. Larger objects are passed to the global
+ * operator new.
+ *
+ * \ref release returns all arenas at once in O(arenas), without visiting
+ * the objects. Hence, it is only safe for objects which do not own other
+ * resources (or whose resources are released separately).
+ *
+ * \note Not Threadsafe: use one pool per lock (e.g. per table shard), which
+ *       also avoids any contention between the pools.
+ */
+template <size_t ArenaSize = 524288>
+class PoolAllocator {
+ public:
+  static constexpr size_t granularity = 16;
+  static constexpr size_t max_size = 256;
+  static constexpr size_t num_classes = max_size / granularity;
+  static_assert(ArenaSize >= max_size, "arena too small");
+
+ private:
+  struct FreeObject {
+    FreeObject* next;
+  };
+
+  std::array<FreeObject*, num_classes> _free{};
+  std::vector<char*> _arenas;
+  /// unused part of the current arena
+  char* _cur{nullptr};
+  size_t _left{0};
+
+  static inline size_t size_class(size_t size) {
+    return size == 0 ? 0 : (size - 1) / granularity;
+  }
+
+  void new_arena() {
+    _arenas.reserve(_arenas.size() + 1);
+    _cur = static_cast<char*>(::operator new(ArenaSize));
+    _arenas.push_back(_cur);
+    _left = ArenaSize;
+  }
+
+ public:
+  PoolAllocator() = default;
+  PoolAllocator(const PoolAllocator&) = delete;
+  PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+  ~PoolAllocator() { release(); }
+
+  /**
+   * \brief allocate memory for an object of the given size
+   * \throws std::bad_alloc
+   */
+  void* allocate(size_t size) {
+    if (size > max_size) {
+      return ::operator new(size);
+    }
+    const size_t cls = size_class(size);
+    FreeObject* obj = _free[cls];
+    if (obj != nullptr) {
+      _free[cls] = obj->next;
+      return obj;
+    }
+    const size_t bytes = (cls + 1) * granularity;
+    if (_left < bytes) {
+      new_arena();
+    }
+    void* ptr = _cur;
+    _cur += bytes;
+    _left -= bytes;
+    return ptr;
+  }
+
+  /// return memory of allocate(size) to the pool
+  void deallocate(void* ptr, size_t size) {
+    if (size > max_size) {
+      ::operator delete(ptr);
+      return;
+    }
+    const size_t cls = size_class(size);
+    FreeObject* obj = static_cast<FreeObject*>(ptr);
+    obj->next = _free[cls];
+    _free[cls] = obj;
+  }
+
+  /**
+   * \brief free all arenas
+   * \warning the objects are not destructed, large objects (see
+   *          \ref max_size) have to be deallocated individually
+   */
+  void release() {
+    for (char* arena : _arenas) {
+      ::operator delete(arena);
+    }
+    _arenas.clear();
+    _free.fill(nullptr);
+    _cur = nullptr;
+    _left = 0;
+  }
+
+  /// number of allocated arenas
+  size_t num_arenas() const { return _arenas.size(); }
+
+  /// create an object in the pool
+  template <class T, class... Args>
+  T* create(Args&&... args) {
+    static_assert(alignof(T) <= granularity, "unsupported alignment");
+    void* ptr = allocate(sizeof(T));
+    try {
+      return new (ptr) T(std::forward<Args>(args)...);
+    } catch (...) {
+      deallocate(ptr, sizeof(T));
+      throw;
+    }
+  }
+
+  /// destruct an object of the pool and return its memory
+  template <class T>
+  void destroy(T* obj) {
+    obj->~T();
+    deallocate(obj, sizeof(T));
+  }
+};
+
+}  // namespace util
@@ -2,6 +2,15 @@
 #include "fasttrack_dr_export.h"
 #include "ipc/DrLock.h"
 
+// the variants of the detector only differ in the policy
+#ifndef FASTTRACK_POLICY
+#define FASTTRACK_POLICY DefaultPolicy
+#endif
+
 extern "C" FASTTRACK_DR_EXPORT Detector* CreateDetector() {
-  return new drace::detector::Fasttrack<DrLock>();  // NOLINT
-}
\ No newline at end of file
+  using drace::detector::FASTTRACK_POLICY;
+  // client threads have to be created by DynamoRIO, hence report the races
+  // on the detecting threads
+  return new drace::detector::Fasttrack<DrLock, VectorClock<>,
+                                        FASTTRACK_POLICY>(false);  // NOLINT
+}
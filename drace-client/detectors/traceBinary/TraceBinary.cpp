@@ -9,17 +9,23 @@
  * SPDX-License-Identifier: MIT
  */
 
-#include <fstream>
-#include <iostream>
-#include <string>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
 
 #include <detector/Detector.h>
 #include <dr_api.h>
 #include <ipc/ExtsanData.h>
+#include <ipc/TraceFormat.h>
 
 #ifdef WINDOWS
+#include <windows.h>
 #define TRACEBINARY_EXPORT __declspec(dllexport)
 #else
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
 #define TRACEBINARY_EXPORT
 #endif
 
@@ -27,16 +33,53 @@ using namespace ipc::event;
 
 namespace drace {
 namespace detector {
-/// Fake detector that traces all calls to the \ref Detector interface
+/**
+ * \brief Fake detector that traces all calls to the \ref Detector interface
+ *
+ * The events are written in the compact trace format (see
+ * \ref ipc::trace). Each thread encodes its events into its own buffer
+ * (passed as tls), hence no lock is taken on the hot path. Full blocks are
+ * written to a reserved range of the shared file with a positional write.
+ */
 class TraceBinary : public Detector {
  private:
+  /// stream of events without a calling thread (join)
+  static constexpr uint32_t control_stream = 0xFFFFFFFF;
+
+  /// events of a thread, only written by this thread
+  struct ThreadStream {
+    uint32_t tid;
+    ipc::trace::StreamEncoder encoder;
+
+    explicit ThreadStream(uint32_t tid) : tid(tid), encoder(tid) {}
+  };
+
+  /// protects the list of threads and the control stream
   void* iolock;
-  std::fstream file;
+  std::vector<ThreadStream*> threads;
+  ipc::trace::StreamEncoder control{control_stream};
+  /// last sequence number of a synchronization event
+  std::atomic<uint64_t> seq{0};
+  /// end of the file, blocks are appended by reserving a range
+  std::atomic<uint64_t> file_end{0};
+#ifdef WINDOWS
+  HANDLE file;
+#else
+  int file;
+#endif
 
  public:
   TraceBinary() {
     iolock = dr_mutex_create();
-    file = std::fstream("trace.bin", std::ios::out | std::ios::binary);
+#ifdef WINDOWS
+    file = CreateFileA("trace.bin", GENERIC_WRITE, FILE_SHARE_READ, NULL,
+                       CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+#else
+    file = open("trace.bin", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    const ipc::trace::FileHeader header = ipc::trace::make_file_header();
+    write_at(reinterpret_cast<const uint8_t*>(&header), sizeof(header), 0);
+    file_end = sizeof(header);
   }
 
   virtual bool init(int argc, const char** argv, Callback rc_clb,
@@ -45,101 +88,130 @@ class TraceBinary : public Detector {
   }
 
   virtual void finalize() {
+    dr_mutex_lock(iolock);
+    for (ThreadStream* stream : threads) {
+      flush(&stream->encoder);
+      delete stream;
+    }
+    threads.clear();
+    flush(&control);
+    dr_mutex_unlock(iolock);
     dr_mutex_destroy(iolock);
-    file.close();
+#ifdef WINDOWS
+    CloseHandle(file);
+#else
+    close(file);
+#endif
   }
 
   virtual void map_shadow(void* startaddr, size_t size_in_bytes){};
 
   virtual void func_enter(tls_t tls, void* pc) {
     ipc::event::BufferEntry buf{Type::FUNCENTER};
-    buf.payload.funcenter = {(uint32_t)(uintptr_t)tls, (uintptr_t)pc};
-    write_log_sync(buf);
+    buf.payload.funcenter = {tid(tls), (uintptr_t)pc};
+    write_log(tls, buf);
   }
 
   virtual void func_exit(tls_t tls) {
     ipc::event::BufferEntry buf{Type::FUNCEXIT};
-    buf.payload.funcexit = {(uint32_t)(uintptr_t)tls};
-    write_log_sync(buf);
+    buf.payload.funcexit = {tid(tls)};
+    write_log(tls, buf);
   }
 
   virtual void acquire(tls_t tls, void* mutex, int recursive, bool write) {
     ipc::event::BufferEntry buf{Type::ACQUIRE};
-    buf.payload.mutex = {(uint32_t)(uintptr_t)tls, (uintptr_t)mutex,
+    buf.payload.mutex = {tid(tls), (uintptr_t)mutex,
                          (int)recursive, write, true};
-    write_log_sync(buf);
+    write_log(tls, buf);
   }
 
   virtual void release(tls_t tls, void* mutex, bool write) {
     ipc::event::BufferEntry buf{Type::RELEASE};
-    buf.payload.mutex = {(uint32_t)(uintptr_t)tls, (uintptr_t)mutex, (int)0,
+    buf.payload.mutex = {tid(tls), (uintptr_t)mutex, (int)0,
                          write, false};
-    write_log_sync(buf);
+    write_log(tls, buf);
   }
 
   virtual void happens_before(tls_t tls, void* identifier) {
     ipc::event::BufferEntry buf{Type::HAPPENSBEFORE};
-    buf.payload.happens = {(uint32_t)(uintptr_t)tls, (uintptr_t)identifier};
-    write_log_sync(buf);
+    buf.payload.happens = {tid(tls), (uintptr_t)identifier};
+    write_log(tls, buf);
   }
 
   virtual void happens_after(tls_t tls, void* identifier) {
     ipc::event::BufferEntry buf{Type::HAPPENSAFTER};
-    buf.payload.happens = {(uint32_t)(uintptr_t)tls, (uintptr_t)identifier};
-    write_log_sync(buf);
+    buf.payload.happens = {tid(tls), (uintptr_t)identifier};
+    write_log(tls, buf);
   }
 
   virtual void read(tls_t tls, void* pc, void* addr, size_t size) {
     ipc::event::BufferEntry buf{Type::MEMREAD};
-    buf.payload.memaccess = {(uint32_t)(uintptr_t)tls, (uintptr_t)pc,
+    buf.payload.memaccess = {tid(tls), (uintptr_t)pc,
                              (uintptr_t)addr, (uintptr_t)size};
-    write_log_sync(buf);
+    write_log(tls, buf);
   }
 
   virtual void write(tls_t tls, void* pc, void* addr, size_t size) {
     ipc::event::BufferEntry buf{Type::MEMWRITE};
-    buf.payload.memaccess = {(uint32_t)(uintptr_t)tls, (uintptr_t)pc,
+    buf.payload.memaccess = {tid(tls), (uintptr_t)pc,
                              (uintptr_t)addr, (uintptr_t)size};
-    write_log_sync(buf);
+    write_log(tls, buf);
   }
 
   virtual void allocate(tls_t tls, void* pc, void* addr, size_t size) {
     ipc::event::BufferEntry buf{Type::ALLOCATION};
-    buf.payload.allocation = {(uint32_t)(uintptr_t)tls, (uintptr_t)pc,
+    buf.payload.allocation = {tid(tls), (uintptr_t)pc,
                               (uintptr_t)addr, (uintptr_t)size};
-    write_log_sync(buf);
+    write_log(tls, buf);
   }
 
   virtual void deallocate(tls_t tls, void* addr) {
     ipc::event::BufferEntry buf{Type::FREE};
-    buf.payload.allocation = {(uint32_t)(uintptr_t)tls, (uintptr_t)0x0,
+    buf.payload.allocation = {tid(tls), (uintptr_t)0x0,
                               (uintptr_t)addr, (uintptr_t)0x0};
-    write_log_sync(buf);
+    write_log(tls, buf);
   }
 
   virtual void fork(tid_t parent, tid_t child, tls_t* tls) {
-    *tls = (void*)((uintptr_t)child);
+    ThreadStream* stream = new ThreadStream((uint32_t)child);
+    dr_mutex_lock(iolock);
+    threads.push_back(stream);
+    dr_mutex_unlock(iolock);
+    *tls = stream;
     ipc::event::BufferEntry buf{Type::FORK};
     buf.payload.forkjoin = {(uint32_t)(uintptr_t)parent, (uint32_t)child};
-    write_log_sync(buf);
+    write_log(*tls, buf);
   }
 
   virtual void join(tid_t parent, tid_t child) {
     ipc::event::BufferEntry buf{Type::JOIN};
     buf.payload.forkjoin = {(uint32_t)(uintptr_t)parent, (uint32_t)child};
-    write_log_sync(buf);
+    dr_mutex_lock(iolock);
+    control.add(buf, ++seq);
+    if (control.full()) {
+      flush(&control);
+    }
+    dr_mutex_unlock(iolock);
   }
 
   virtual void detach(tls_t tls, tid_t thread_id) {
     ipc::event::BufferEntry buf{Type::DETACH};
-    buf.payload.detachfinish = {(uint32_t)(uintptr_t)tls};
-    write_log_sync(buf);
+    buf.payload.detachfinish = {tid(tls)};
+    write_log(tls, buf);
   };
 
   virtual void finish(tls_t tls, tid_t thread_id) {
     ipc::event::BufferEntry buf{Type::FINISH};
-    buf.payload.detachfinish = {(uint32_t)(uintptr_t)tls};
-    write_log_sync(buf);
+    buf.payload.detachfinish = {tid(tls)};
+    write_log(tls, buf);
+
+    // the thread is gone, write its last block
+    ThreadStream* stream = static_cast<ThreadStream*>(tls);
+    dr_mutex_lock(iolock);
+    threads.erase(std::find(threads.begin(), threads.end(), stream));
+    dr_mutex_unlock(iolock);
+    flush(&stream->encoder);
+    delete stream;
   };
 
   virtual const char* name() { return "Dummy"; }
@@ -147,10 +219,45 @@ class TraceBinary : public Detector {
   virtual const char* version() { return "1.0.0"; }
 
  private:
-  void write_log_sync(const ipc::event::BufferEntry& event) {
-    dr_mutex_lock(iolock);
-    file.write((char*)&event, sizeof(ipc::event::BufferEntry));
-    dr_mutex_unlock(iolock);
+  static uint32_t tid(tls_t tls) {
+    return static_cast<ThreadStream*>(tls)->tid;
+  }
+
+  void write_log(tls_t tls, const ipc::event::BufferEntry& event) {
+    ipc::trace::StreamEncoder& encoder =
+        static_cast<ThreadStream*>(tls)->encoder;
+    encoder.add(event, ipc::trace::has_seq(event.type) ? ++seq : 0);
+    if (encoder.full()) {
+      flush(&encoder);
+    }
+  }
+
+  /// write the current block of the encoder to a new range of the file
+  void flush(ipc::trace::StreamEncoder* encoder) {
+    if (encoder->empty()) return;
+    const size_t size = encoder->size();
+    const uint64_t offset = file_end.fetch_add(size);
+    write_at(encoder->data(), size, offset);
+    encoder->next_block();
+  }
+
+  void write_at(const uint8_t* data, size_t size, uint64_t offset) {
+#ifdef WINDOWS
+    OVERLAPPED pos{};
+    pos.Offset = static_cast<DWORD>(offset);
+    pos.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD written;
+    WriteFile(file, data, static_cast<DWORD>(size), &written, &pos);
+#else
+    while (size > 0) {
+      const ssize_t written = pwrite(file, data, size, offset);
+      if (written < 0 && errno == EINTR) continue;
+      if (written <= 0) break;
+      data += written;
+      size -= written;
+      offset += written;
+    }
+#endif
   }
 };
 }  // namespace detector
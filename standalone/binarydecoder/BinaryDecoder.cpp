@@ -8,51 +8,130 @@
  *
  * SPDX-License-Identifier: MIT
  */
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
 
 #include <clipp.h>
 #include <ipc/ExtsanData.h>
+#include <ipc/TraceFormat.h>
+#include <util/MappedFile.h>
 #include "DetectorOutput.h"
+#include "ReplayStats.h"
+
+/// number of replayed legacy events after which their pages are dropped
+static constexpr size_t release_interval = 1 << 20;
+
+/**
+ * \brief calls fn for each event of the trace
+ *
+ * The trace is replayed in place, already replayed pages are dropped
+ * periodically, hence the memory usage does not depend on the size of the
+ * trace.
+ */
+template <typename Fn>
+void for_each_event(util::MappedFile* trace, Fn&& fn) {
+  const uint8_t* data = trace->data();
+  const size_t size = trace->size();
+
+  if (ipc::trace::is_trace(data, size)) {
+    ipc::trace::TraceReader reader(
+        data, size,
+        [trace](size_t begin, size_t end) { trace->release(begin, end); });
+    ipc::event::BufferEntry tmp;
+    while (reader.next(&tmp)) {
+      fn(&tmp);
+    }
+  } else {
+    // legacy format: plain event records
+    trace->advise_sequential();
+    const size_t num = size / sizeof(ipc::event::BufferEntry);
+    for (size_t i = 0; i < num; ++i) {
+      ipc::event::BufferEntry tmp;
+      std::memcpy(&tmp, data + i * sizeof(tmp), sizeof(tmp));
+      fn(&tmp);
+      if ((i + 1) % release_interval == 0) {
+        trace->release((i + 1 - release_interval) * sizeof(tmp),
+                       (i + 1) * sizeof(tmp));
+      }
+    }
+  }
+}
+
+/// replays the trace repeatedly and reports the throughput of the detector
+void benchmark(const std::string& detec, util::MappedFile* trace,
+               unsigned repetitions, ReplayStats* stats) {
+  for (unsigned i = 0; i < repetitions; ++i) {
+    // a fresh detector for each repetition
+    DetectorOutput output(detec.c_str(), false);
+    const auto begin = ReplayStats::clock::now();
+    stats->begin();
+    for_each_event(trace, [&](ipc::event::BufferEntry* e) {
+      stats->record(e->type);
+      output.makeOutput(e);
+    });
+    output.finalize();
+    const std::chrono::duration<double> seconds =
+        ReplayStats::clock::now() - begin;
+    stats->end(seconds.count(), output.races());
+  }
+}
 
 int main(int argc, char** argv) {
   //    std::string detec = "drace.detector.tsan.dll";
   std::string detec = "drace.detector.fasttrack.standalone.dll";
   std::string file = "trace.bin";
+  bool bench = false;
+  unsigned repetitions = 1;
+  std::string json;
 
   auto cli = clipp::group(
       (clipp::option("-d", "--detector") & clipp::value("detector", detec)) %
           ("race detector (default: " + detec + ")"),
       (clipp::option("-f", "--filename") & clipp::value("filename", file)) %
-          ("filename (default: " + file + ")"));
-  if (!clipp::parse(argc, (char**)argv, cli)) {
+          ("filename (default: " + file + ")"),
+      clipp::option("-b", "--bench").set(bench) %
+          "benchmark mode: report the throughput of the detector",
+      (clipp::option("-r", "--repeat") & clipp::value("n", repetitions)) %
+          "number of repetitions in benchmark mode (default: 1)",
+      (clipp::option("-j", "--json") & clipp::value("file", json)) %
+          "write the benchmark results as JSON to file");
+  if (!clipp::parse(argc, (char**)argv, cli) || repetitions == 0) {
     std::cout << clipp::make_man_page(cli, argv[0]) << std::endl;
     return -1;
   }
 
   std::cout << "Detector: " << detec.c_str() << std::endl;
+  std::unique_ptr<util::MappedFile> trace;
   try {
-    DetectorOutput output(detec.c_str());
-
-    std::ifstream in_file(file, std::ios::binary | std::ios::ate);
-    if (!in_file.good()) {
-      std::cerr << "File not found: " << file << std::endl;
-      return 1;
-    }
-    std::streamsize size = in_file.tellg();
-    in_file.seekg(0, std::ios::beg);
-
-    std::vector<ipc::event::BufferEntry> buffer(
-        (size_t)(size / sizeof(ipc::event::BufferEntry)));
-
-    // ipc::event::BufferEntry buf;
-    // int i = 0;
+    trace = std::make_unique<util::MappedFile>(file);
+  } catch (const std::runtime_error&) {
+    std::cerr << "Could not read file: " << file << std::endl;
+    return 1;
+  }
 
-    if (in_file.read((char*)(buffer.data()), size).good()) {
-      for (auto it = buffer.begin(); it != buffer.end(); ++it) {
-        ipc::event::BufferEntry tmp = *it;
-        output.makeOutput(&tmp);
+  try {
+    if (bench || !json.empty()) {
+      ReplayStats stats;
+      benchmark(detec, trace.get(), repetitions, &stats);
+      std::cout << std::endl;
+      stats.print(std::cout);
+      if (!json.empty()) {
+        std::ofstream out(json);
+        stats.print_json(out, detec, file);
+        if (!out.good()) {
+          std::cerr << "Could not write file: " << json << std::endl;
+          return 1;
+        }
       }
+    } else {
+      DetectorOutput output(detec.c_str());
+      for_each_event(trace.get(), [&output](ipc::event::BufferEntry* e) {
+        output.makeOutput(e);
+      });
     }
   } catch (const std::exception& e) {
     std::cerr << "Could not load detector: " << e.what() << std::endl;
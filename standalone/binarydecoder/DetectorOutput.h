@@ -9,6 +9,10 @@
 
 class DetectorOutput {
   std::unordered_map<uint32_t, void**> tls;
+  /// print the status and the races
+  bool _verbose;
+  bool _finalized{false};
+  size_t _races{0};
 
   void** allocate_memory(uint32_t tid) {
     void** mem = new void*;
@@ -28,7 +32,8 @@ class DetectorOutput {
   std::unique_ptr<Detector> _det;
 
  public:
-  explicit DetectorOutput(const char* detector) {
+  explicit DetectorOutput(const char* detector, bool verbose = true)
+      : _verbose(verbose) {
     if (!_libdetector->load(detector)) {
       throw std::runtime_error("could not load library");
     }
@@ -40,19 +45,29 @@ class DetectorOutput {
     _det = std::unique_ptr<Detector>(create_detector());
 
     const char* _argv = "";
-    _det->init(1, &_argv, callback, nullptr);
+    _det->init(1, &_argv, callback, this);
 
-    std::cout << "init_done\n";
+    if (_verbose) std::cout << "init_done\n";
   }
 
   ~DetectorOutput() {
-    _det->finalize();
+    finalize();
     for (auto it = tls.begin(); it != tls.end(); it++) {
       delete it->second;
     }
-    std::cout << "finished ";
+    if (_verbose) std::cout << "finished ";
   }
 
+  /// finalizes the detector, which may report pending races
+  void finalize() {
+    if (_finalized) return;
+    _det->finalize();
+    _finalized = true;
+  }
+
+  /// number of races reported by the detector
+  size_t races() const { return _races; }
+
   void makeOutput(ipc::event::BufferEntry* buf) {
     switch (buf->type) {
       case ipc::event::Type::FUNCENTER:
@@ -127,6 +142,9 @@ class DetectorOutput {
   }
 
   static void callback(const Detector::Race* race, void* context) {
+    DetectorOutput* self = static_cast<DetectorOutput*>(context);
+    ++self->_races;
+    if (!self->_verbose) return;
     static uintptr_t s1 = 0, s2 = 0;
     if (s1 != race->first.stack_trace[0] && s2 != race->second.stack_trace[0]) {
       static int i = 0;
@@ -0,0 +1,189 @@
+#ifndef REPLAY_STATS_H
+#define REPLAY_STATS_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <ipc/ExtsanData.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/**
+ * \brief Throughput of a detector while replaying a trace
+ *
+ * The time of an event type is measured for each run of consecutive events
+ * of this type, hence the clock is only read when the type changes.
+ */
+class ReplayStats {
+ public:
+  using clock = std::chrono::steady_clock;
+  static constexpr size_t num_types =
+      static_cast<size_t>(ipc::event::Type::FUNCEXIT) + 1;
+
+ private:
+  std::array<uint64_t, num_types> _events{};
+  std::array<clock::duration, num_types> _time{};
+  /// duration and number of races of each repetition
+  std::vector<double> _seconds;
+  std::vector<size_t> _races;
+
+  ipc::event::Type _run_type{ipc::event::Type::NONE};
+  clock::time_point _run_begin;
+
+  static const char* type_name(size_t type) {
+    static const char* names[num_types] = {
+        "NONE",       "MEMREAD", "MEMWRITE", "ACQUIRE",   "RELEASE",
+        "HAPPENSBEFORE", "HAPPENSAFTER", "ALLOCATION", "FREE", "FORK",
+        "JOIN",       "DETACH",  "FINISH",   "FUNCENTER", "FUNCEXIT"};
+    return names[type];
+  }
+
+  uint64_t total_events() const {
+    uint64_t sum = 0;
+    for (uint64_t n : _events) sum += n;
+    return sum;
+  }
+
+  double best_seconds() const {
+    return *std::min_element(_seconds.begin(), _seconds.end());
+  }
+
+  double mean_seconds() const {
+    double sum = 0;
+    for (double s : _seconds) sum += s;
+    return sum / _seconds.size();
+  }
+
+  static double rate(uint64_t events, double seconds) {
+    return seconds > 0 ? events / seconds : 0;
+  }
+
+ public:
+  /// starts the measurement of a repetition
+  void begin() {
+    _run_type = ipc::event::Type::NONE;
+    _run_begin = clock::now();
+  }
+
+  /// counts the event, call it before the event is replayed
+  inline void record(ipc::event::Type type) {
+    if (type != _run_type) {
+      const clock::time_point now = clock::now();
+      _time[static_cast<size_t>(_run_type)] += now - _run_begin;
+      _run_begin = now;
+      _run_type = type;
+    }
+    ++_events[static_cast<size_t>(type)];
+  }
+
+  /// ends the measurement of a repetition
+  void end(double seconds, size_t races) {
+    _time[static_cast<size_t>(_run_type)] += clock::now() - _run_begin;
+    _seconds.push_back(seconds);
+    _races.push_back(races);
+  }
+
+  /// peak resident set size of the process in bytes
+  static size_t peak_rss() {
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                              sizeof(counters))) {
+      return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+  }
+
+  void print(std::ostream& out) const {
+    if (_seconds.empty()) return;
+    const uint64_t events = total_events() / _seconds.size();
+    out << "events:      " << events << " per repetition\n"
+        << "repetitions: " << _seconds.size() << "\n"
+        << "time:        " << best_seconds() << " s (best), "
+        << mean_seconds() << " s (mean)\n"
+        << "throughput:  " << std::fixed << std::setprecision(0)
+        << rate(events, best_seconds()) << " events/s (best)\n"
+        << "races:       " << _races.back() << "\n"
+        << "peak rss:    " << (peak_rss() >> 20) << " MiB\n";
+    for (size_t t = 0; t < num_types; ++t) {
+      if (_events[t] == 0) continue;
+      const double seconds = std::chrono::duration<double>(_time[t]).count();
+      out << "  " << std::left << std::setw(14) << type_name(t) << std::right
+          << std::setw(12) << _events[t] / _seconds.size() << " events "
+          << std::setw(14) << rate(_events[t], seconds) << " events/s\n";
+    }
+    out << std::defaultfloat;
+  }
+
+  void print_json(std::ostream& out, const std::string& detector,
+                  const std::string& trace) const {
+    if (_seconds.empty()) return;
+    const uint64_t events = total_events() / _seconds.size();
+    out << std::setprecision(9) << "{\n"
+        << "  \"detector\": \"" << escape(detector) << "\",\n"
+        << "  \"trace\": \"" << escape(trace) << "\",\n"
+        << "  \"repetitions\": " << _seconds.size() << ",\n"
+        << "  \"events\": " << events << ",\n"
+        << "  \"races\": " << _races.back() << ",\n"
+        << "  \"peak_rss_bytes\": " << peak_rss() << ",\n"
+        << "  \"seconds\": [";
+    for (size_t i = 0; i < _seconds.size(); ++i) {
+      out << (i ? ", " : "") << _seconds[i];
+    }
+    out << "],\n"
+        << "  \"events_per_second\": {\"best\": "
+        << rate(events, best_seconds())
+        << ", \"mean\": " << rate(events, mean_seconds()) << "},\n"
+        << "  \"types\": {";
+    bool first = true;
+    for (size_t t = 0; t < num_types; ++t) {
+      if (_events[t] == 0) continue;
+      const double seconds = std::chrono::duration<double>(_time[t]).count();
+      out << (first ? "\n" : ",\n") << "    \"" << type_name(t)
+          << "\": {\"events\": " << _events[t] / _seconds.size()
+          << ", \"seconds\": " << seconds / _seconds.size()
+          << ", \"events_per_second\": " << rate(_events[t], seconds) << "}";
+      first = false;
+    }
+    out << "\n  }\n}\n" << std::setprecision(6);
+  }
+
+ private:
+  static std::string escape(const std::string& str) {
+    std::string out;
+    for (char c : str) {
+      if (c == '"' || c == '\\') out += '\\';
+      out += c;
+    }
+    return out;
+  }
+};
+
+#endif  // REPLAY_STATS_H
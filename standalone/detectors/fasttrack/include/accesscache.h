@@ -0,0 +1,95 @@
+#ifndef ACCESSCACHE_H
+#define ACCESSCACHE_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "vectorclock.h"
+
+class VarState;
+
+/**
+ * \brief Direct-mapped cache of the recent accesses of a single thread
+ *
+ * Each entry maps an address to its variable state and the epoch of the
+ * last access of the thread. A repeated access in the same epoch cannot
+ * change the variable state, hence it is skipped without looking up the
+ * variable. A write also covers later reads of the same epoch.
+ *
+ * The cached states might be destroyed or reset when memory is freed.
+ * Hence, each entry records the free generation of the detector at the
+ * time it was filled and is only valid as long as it did not change.
+ *
+ * \note Not Threadsafe, only used by the owning thread
+ */
+class AccessCache {
+ public:
+  using VC_ID = VectorClock<>::VC_ID;
+
+  static constexpr unsigned cache_bits = 8;
+  static constexpr size_t cache_size = size_t(1) << cache_bits;
+
+  struct Entry {
+    size_t addr{0};
+    VarState* var{nullptr};
+    /// epoch of the last access, 0 if the entry is empty
+    VC_ID epoch{0};
+    /// free generation of the detector when the entry was filled
+    uint64_t generation{0};
+    bool write{false};
+  };
+
+ private:
+  std::array<Entry, cache_size> _entries{};
+
+ public:
+  /// returns the slot of addr (which might hold another address)
+  inline Entry& slot(size_t addr) {
+    // accesses are at least 4-byte aligned in most cases
+    return _entries[(addr >> 2) & (cache_size - 1)];
+  }
+
+  /**
+   * \brief returns the cached state of addr
+   * \return nullptr if the entry is missing or outdated
+   */
+  inline Entry* lookup(size_t addr, uint64_t generation) {
+    Entry& e = slot(addr);
+    if (e.addr != addr || e.generation != generation || e.var == nullptr) {
+      return nullptr;
+    }
+    return &e;
+  }
+
+  /// returns true if the access can be skipped (same epoch, covering access)
+  static inline bool is_redundant(const Entry& e, VC_ID epoch, bool write) {
+    return e.epoch == epoch && (e.write || !write);
+  }
+
+  /// record an access of the thread
+  inline void fill(size_t addr, VarState* var, VC_ID epoch, uint64_t generation,
+                   bool write) {
+    Entry& e = slot(addr);
+    if (e.addr == addr && e.generation == generation && e.epoch == epoch) {
+      // keep the covering write
+      write = write || e.write;
+    }
+    e.addr = addr;
+    e.var = var;
+    e.epoch = epoch;
+    e.generation = generation;
+    e.write = write;
+  }
+
+  /// drop all entries
+  void clear() { _entries.fill(Entry()); }
+};
+
+#endif  // !ACCESSCACHE_H
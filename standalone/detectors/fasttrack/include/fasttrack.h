@@ -13,64 +13,107 @@
 
 #include <detector/Detector.h>
 #include <ipc/spinlock.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>  // for lock_guard
 #include <shared_mutex>
+#include <thread>
+#include <vector>
+#include "accesscache.h"
+#include "heapblocks.h"
 #include "parallel_hashmap/phmap.h"
+#include "policy.h"
+#include "racequeue.h"
+#include "shadowmemory.h"
+#include "slotallocator.h"
 #include "stacktrace.h"
+#include "synctable.h"
 #include "threadstate.h"
+#include "treeclock.h"
 #include "varstate.h"
+#include "vartable.h"
 #include "xvector.h"
 
-#define MAKE_OUTPUT false
-#define REGARD_ALLOCS true
-#define POOL_ALLOC false
-
-///\todo implement a pool allocator
-#if POOL_ALLOC
-#include "util/PoolAllocator.h"
-#endif
-
 namespace drace {
 namespace detector {
 
-template <class LockT>
+/**
+ * \brief FastTrack race detector
+ *
+ * \tparam LockT lock which protects the global tables
+ * \tparam ClockT clock used for threads and synchronization objects. A
+ *         \ref TreeClock makes synchronization operations proportional to
+ *         the number of entries that change.
+ * \tparam Policy compile-time feature selection, see \ref DefaultPolicy
+ */
+template <class LockT, class ClockT = VectorClock<>,
+          class Policy = DefaultPolicy>
 class Fasttrack : public Detector {
  public:
+  typedef ThreadStateT<ClockT> ThreadState;
   typedef size_t tid_ft;
   // make some shared pointers a bit more handy
   typedef std::shared_ptr<ThreadState> ts_ptr;
 
-#if POOL_ALLOC
-  template <class X>
-  using c_alloc = Allocator<X, 524288>;
-#else
-  template <class X>
-  using c_alloc = std::allocator<X>;
-#endif
-
  private:
-  /// these maps hold the various state objects together with the identifiers
-  phmap::parallel_flat_hash_map<size_t, size_t> allocs;
-  // we have to use a node hash map here, as we access the nodes from multiple
-  // threads, while the map might grow in the meantime. \todo for memory
-  // efficiency and locality, better use (userspace) RW-locks and use
-  //       the flat version of the map
-  phmap::parallel_node_hash_map<size_t, VarState> vars;
-  // number of locks, threads is expected to be < 1000, hence use one map
+  /// live heap blocks
+  HeapBlocks allocs;
+  /// variables outside of the shadow memory, protected by per-shard locks
+  typename Policy::VarTableT vars;
+  /// direct-mapped variable states of all regions passed to \ref map_shadow.
+  /// Their read-shared clocks are allocated from vars, hence it is declared
+  /// after vars.
+  ShadowMemory<VarState> shadow;
+  /// clocks of the mutexes, each protected by its own lock
+  SyncTable<ClockT> locks;
+  // number of threads is expected to be < 1000, hence use one map
   // (without submaps)
-  phmap::flat_hash_map<void*, VectorClock<>> locks;
   phmap::flat_hash_map<tid_ft, ts_ptr> threads;
-  phmap::parallel_flat_hash_map<void*, VectorClock<>> happens_states;
+  /// maps the compact thread ids (slots) used in the clocks to the threads
+  SlotAllocator<ThreadState> slots;
+  /// clocks of the happens-before identifiers, each protected by its own lock
+  SyncTable<ClockT> happens_states;
+  /// number of collections after which unused happens-before identifiers are
+  /// dropped, 0 to keep them (see \ref SyncTable::collect)
+  uint32_t max_sync_age = 0;
+  /// final clocks of finished threads, inherited by the next owner of the
+  /// slot (only used for tree clocks, see \ref TreeClock::inherit())
+  std::vector<ClockT> retired_clocks;
+  /// incremented whenever variable states are destroyed or reset, which
+  /// invalidates all entries of the access caches (see \ref AccessCache)
+  std::atomic<uint64_t> free_generation{1};
 
   /// holds the callback address to report a race to the drace-main
   Callback clb;
   void* clb_context;
 
+  /// detected races which are not yet reported
+  RaceQueue races;
+  /// races which have been queued recently
+  RaceFilter queued_races;
+  /// false if the detector must not spawn threads
+  const bool threads_allowed;
+  /// report the races on a dedicated thread instead of the detecting one
+  bool async_reports = false;
+  std::thread reporter;
+  std::mutex reporter_mx;
+  std::condition_variable reporter_cv;
+  std::atomic<bool> reporter_stop{false};
+
   /// switch logging of read/write operations
   bool log_flag = false;
 
+  /// true if the rule hits are counted
+  inline bool stats_enabled() const {
+    return Policy::collect_stats && log_flag;
+  }
+
   /// internal statistics
   struct log_counters {
     uint32_t read_ex_same_epoch = 0;
@@ -81,66 +124,70 @@ class Fasttrack : public Detector {
     uint32_t write_same_epoch = 0;
     uint32_t write_exclusive = 0;
     uint32_t write_shared = 0;
+    uint32_t cache_same_epoch = 0;
+    uint32_t cache_var = 0;
   } log_count;
 
-  /// central lock, used for accesses to global tables except vars (order: 1)
+  /// central lock, used for accesses to global tables except vars, locks and
+  /// happens_states (order: 1)
   LockT g_lock;  // global Lock
 
-  /// spinlock to protect accesses to vars table (order: 2)
-  mutable ipc::spinlock vars_spl;
-
   /**
    * \brief report a data-race back to DRace
+   *
+   * The variable state does not store the access size, hence the size of the
+   * access that detected the race is reported for both accesses. The stacks
+   * are reconstructed from the history ids of the accesses.
+   * Races with accesses of finished threads are not reported. As slots are
+   * reused, this is detected by comparing the epoch of the first access
+   * with the start clock of the current owner of the slot.
+   *
    * \note the function itself must not use locks
    * \note Invariant: this function requires a lock the following global tables:
-   *                  threads
+   *                  threads, allocs
    */
-  void report_race(uint32_t thr1, uint32_t thr2, bool wr1, bool wr2,
-                   const VarState& var, size_t address) const {
-    auto it = threads.find(thr1);
-    auto it2 = threads.find(thr2);
-    auto it_end = threads.end();
-
-    if (it == it_end ||
-        it2 == it_end) {  // if thread_id is, because of finishing, not in stack
+  void report_race(VectorClock<>::VC_ID id1, uint32_t hist1, uint32_t thr2,
+                   uint32_t hist2, bool wr1, bool wr2, size_t address,
+                   size_t size) const {
+    const auto thr1 = VectorClock<>::make_tid(id1);
+    ThreadState* t1 = slots.owner(thr1);
+    ThreadState* t2 = slots.owner(thr2);
+
+    if (t1 == nullptr ||
+        t2 == nullptr) {  // if thread_id is, because of finishing, not in stack
                           // traces anymore, return
       return;
     }
-    std::list<size_t> stack1(
-        std::move(it->second->get_stackDepot().return_stack_trace(address)));
-    std::list<size_t> stack2(
-        std::move(it2->second->get_stackDepot().return_stack_trace(address)));
-
-    while (stack1.size() > Detector::max_stack_size) {
-      stack1.pop_front();
-    }
-    while (stack2.size() > Detector::max_stack_size) {
-      stack2.pop_front();
+    if (VectorClock<>::make_clock(id1) < slots.start_clock(thr1)) {
+      // first access was done by a previous owner of the slot
+      return;
     }
+    HeapBlocks::Block block;
+    const bool onheap = allocs.find(address, &block);
 
     Detector::AccessEntry access1;
-    access1.thread_id = thr1;
+    access1.thread_id = static_cast<unsigned>(t1->get_os_tid());
     access1.write = wr1;
     access1.accessed_memory = address;
-    access1.access_size = var.size;
+    access1.access_size = size;
     access1.access_type = 0;
-    access1.heap_block_begin = 0;
-    access1.heap_block_size = 0;
-    access1.onheap = false;
-    access1.stack_size = stack1.size();
-    std::copy(stack1.begin(), stack1.end(), access1.stack_trace.begin());
+    access1.heap_block_begin = block.begin;
+    access1.heap_block_size = block.size;
+    access1.onheap = onheap;
+    access1.stack_size = StackDepot::instance().get_frames(
+        hist1, access1.stack_trace.data(), Detector::max_stack_size);
 
     Detector::AccessEntry access2;
-    access2.thread_id = thr2;
+    access2.thread_id = static_cast<unsigned>(t2->get_os_tid());
     access2.write = wr2;
     access2.accessed_memory = address;
-    access2.access_size = var.size;
+    access2.access_size = size;
     access2.access_type = 0;
-    access2.heap_block_begin = 0;
-    access2.heap_block_size = 0;
-    access2.onheap = false;
-    access2.stack_size = stack2.size();
-    std::copy(stack2.begin(), stack2.end(), access2.stack_trace.begin());
+    access2.heap_block_begin = block.begin;
+    access2.heap_block_size = block.size;
+    access2.onheap = onheap;
+    access2.stack_size = StackDepot::instance().get_frames(
+        hist2, access2.stack_trace.data(), Detector::max_stack_size);
 
     Detector::Race race;
     race.first = access1;
@@ -150,23 +197,81 @@ class Fasttrack : public Detector {
   }
 
   /**
-   * \brief Wrapper for report_race to use const qualifier on
-   *        wrapped function
+   * \brief queue a detected race for reporting
+   *
+   * Called while the variable is locked, hence only a lock-free duplicate
+   * check and a push is done here. Duplicates are dropped before the
+   * allocation of the queue entry.
+   */
+  void enqueue_race(VectorClock<>::VC_ID id1, uint32_t hist1, uint32_t thr2,
+                    uint32_t hist2, bool wr1, bool wr2, size_t addr,
+                    size_t size) {
+    if (queued_races.test_and_set(hist1, hist2, addr)) {
+      return;
+    }
+    auto* race =
+        new PendingRace{id1, hist1, thr2, hist2, wr1, wr2, addr, size};
+    if (races.push(race) && async_reports) {
+      reporter_cv.notify_one();
+    }
+  }
+
+  /**
+   * \brief report all queued races
+   * \note Invariant: requires g_lock (which also makes this the only
+   *                  consumer of the queue)
    */
-  void report_race_locked(uint32_t thr1, uint32_t thr2, bool wr1, bool wr2,
-                          const VarState& var, size_t addr) {
-    std::lock_guard<LockT> lg(g_lock);
-    report_race(thr1, thr2, wr1, wr2, var, addr);
+  void drain_races() {
+    while (PendingRace* pending = races.pop()) {
+      std::unique_ptr<PendingRace> race(pending);
+      report_race(race->id1, race->hist1, race->thr2, race->hist2, race->wr1,
+                  race->wr2, race->address, race->size);
+    }
+  }
+
+  /// report the queued races on the calling thread, if there is no reporter
+  inline void flush_races() {
+    if (!async_reports && races.pending() != 0) {
+      std::lock_guard<LockT> lg(g_lock);
+      drain_races();
+    }
+  }
+
+  /// main loop of the reporter thread
+  void reporter_main() {
+    std::unique_lock<std::mutex> ul(reporter_mx);
+    while (!reporter_stop.load(std::memory_order_acquire)) {
+      if (races.pending() == 0) {
+        // a missed notification only delays the report
+        reporter_cv.wait_for(ul, std::chrono::milliseconds(10));
+      }
+      ul.unlock();
+      {
+        std::lock_guard<LockT> lg(g_lock);
+        drain_races();
+      }
+      ul.lock();
+    }
+  }
+
+  void stop_reporter() {
+    if (reporter.joinable()) {
+      reporter_stop.store(true, std::memory_order_release);
+      reporter_cv.notify_one();
+      reporter.join();
+    }
   }
 
   /**
    * \brief takes care of a read access
+   * \param hist history id of the access
    * \note works only on calling-thread and var object, not on any list
    */
-  void read(ThreadState* t, VarState* v, size_t addr) {
+  void read(ThreadState* t, VarState* v, size_t addr, size_t size,
+            uint32_t hist) {
     if (t->return_own_id() ==
         v->get_read_id()) {  // read same epoch, same thread;
-      if (log_flag) {
+      if (stats_enabled()) {
         log_count.read_ex_same_epoch++;
       }
       return;
@@ -177,14 +282,15 @@ class Fasttrack : public Detector {
 
     if (v->is_read_shared() &&
         v->get_vc_by_thr(tid) == id) {  // read shared same epoch
-      if (log_flag) {
+      if (stats_enabled()) {
         log_count.read_sh_same_epoch++;
       }
       return;
     }
 
     if (v->is_wr_race(t)) {  // write-read race
-      report_race_locked(v->get_w_tid(), tid, true, false, *v, addr);
+      enqueue_race(v->get_write_id(), v->get_write_hist(), tid, hist, true,
+                   false, addr, size);
     }
 
     // update vc
@@ -193,31 +299,33 @@ class Fasttrack : public Detector {
           (v->get_r_tid() ==
            tid))  // read exclusive->read of same thread but newer epoch
       {
-        if (log_flag) {
+        if (stats_enabled()) {
           log_count.read_exclusive++;
         }
-        v->update(false, id);
+        v->update(false, id, hist);
       } else {  // read gets shared
-        if (log_flag) {
+        if (stats_enabled()) {
           log_count.read_share++;
         }
-        v->set_read_shared(id);
+        v->set_read_shared(vars.shared_table(), id, hist);
       }
     } else {  // read shared
-      if (log_flag) {
+      if (stats_enabled()) {
         log_count.read_shared++;
       }
-      v->update(false, id);
+      v->update(false, id, hist);
     }
   }
 
   /**
    * \brief takes care of a write access
+   * \param hist history id of the access
    * \note works only on calling-thread and var object, not on any list
    */
-  void write(ThreadState* t, VarState* v, size_t addr) {
+  void write(ThreadState* t, VarState* v, size_t addr, size_t size,
+             uint32_t hist) {
     if (t->return_own_id() == v->get_write_id()) {  // write same epoch
-      if (log_flag) {
+      if (stats_enabled()) {
         log_count.write_same_epoch++;
       }
       return;
@@ -225,10 +333,10 @@ class Fasttrack : public Detector {
 
     if (v->get_write_id() ==
         VarState::VAR_NOT_INIT) {  // initial write, update var
-      if (log_flag) {
+      if (stats_enabled()) {
         log_count.write_exclusive++;
       }
-      v->update(true, t->return_own_id());
+      v->update(true, t->return_own_id(), hist);
       return;
     }
 
@@ -238,74 +346,162 @@ class Fasttrack : public Detector {
     // other thread
     if (v->is_ww_race(t))  // write-write race
     {
-      report_race_locked(v->get_w_tid(), tid, true, true, *v, addr);
+      enqueue_race(v->get_write_id(), v->get_write_hist(), tid, hist, true,
+                   true, addr, size);
     }
 
     if (!v->is_read_shared()) {
-      if (log_flag) {
+      if (stats_enabled()) {
         log_count.write_exclusive++;
       }
       if (v->is_rw_ex_race(t))  // read-write race
       {
-        report_race_locked(v->get_r_tid(), t->get_tid(), false, true, *v, addr);
+        enqueue_race(v->get_read_id(), v->get_read_hist(), tid, hist, false,
+                     true, addr, size);
       }
     } else {  // come here in read shared case
-      if (log_flag) {
+      if (stats_enabled()) {
         log_count.write_shared++;
       }
       uint32_t act_tid = v->is_rw_sh_race(t);
       if (act_tid != 0)  // read shared read-write race
       {
-        report_race_locked(act_tid, tid, false, true, *v, addr);
+        enqueue_race(v->get_vc_by_thr(act_tid), v->get_hist_by_thr(act_tid),
+                     tid, hist, false, true, addr, size);
       }
     }
-    v->update(true, t->return_own_id());
+    v->update(true, t->return_own_id(), hist);
   }
 
   /**
-   * \brief creates a new variable object (is called, when var is read or
-   * written for the first time) \note Invariant: vars table is locked
+   * \brief returns the variable state of an address
+   *
+   * If the address is covered by the shadow memory, the state is found
+   * without taking any lock. Otherwise, it is looked up (and created if new)
+   * in the shard of the vars table. If this evicts cold variables (see
+   * --max-shadow-mb), the access caches are invalidated, as they might point
+   * to the evicted states.
    */
-  inline auto create_var(size_t addr, size_t size) {
-    return vars.emplace(addr, static_cast<uint16_t>(size)).first;
+  inline VarState* get_var(size_t addr) {
+    VarState* var = shadow.find(addr);
+    if (var != nullptr) {
+      return var;
+    }
+    bool evicted = false;
+    var = vars.get_or_create(addr, &evicted);
+    if (evicted) {
+      invalidate_caches();
+    }
+    return var;
   }
 
-  /// creates a new lock object (is called when a lock is acquired or released
-  /// for the first time)
-  inline auto createLock(void* mutex) {
-    return locks
-        .emplace(std::piecewise_construct, std::forward_as_tuple(mutex),
-                 std::forward_as_tuple())
-        .first;
+  /**
+   * \brief returns the variable state of an access, using the access cache
+   *        of the thread
+   *
+   * \return nullptr if the thread already did a covering access in the
+   *         current epoch, hence the access cannot change the state
+   */
+  inline VarState* get_cached_var(ThreadState* t, size_t addr, bool write,
+                                  uint64_t generation) {
+    AccessCache::Entry* e = t->get_accessCache().lookup(addr, generation);
+    if (e == nullptr) {
+      return get_var(addr);
+    }
+    if (AccessCache::is_redundant(*e, t->return_own_id(), write)) {
+      if (stats_enabled()) {
+        log_count.cache_same_epoch++;
+      }
+      return nullptr;
+    }
+    if (stats_enabled()) {
+      log_count.cache_var++;
+    }
+    return e->var;
   }
 
-  /// creates a new thread object (is called when fork() called)
-  ThreadState* create_thread(VectorClock<>::TID tid, ts_ptr parent = nullptr) {
-    ts_ptr new_thread;
-
-    if (nullptr == parent) {
-      new_thread = threads.emplace(tid, std::make_shared<ThreadState>(tid))
-                       .first->second;
+  /**
+   * \brief publishes the clock of a releasing thread to a sync object
+   *
+   * If the clock of the object is known to the thread (it acquired or
+   * released the object last), the join is a copy. If the clock of the
+   * thread did not learn other entries since the last copy, only the own
+   * entry changed. Hence, repeated releases by the same thread are O(1).
+   * \note Invariant: requires the locks of the entry and the thread clock
+   */
+  static void release_clock(ThreadState* thr,
+                            typename SyncTable<ClockT>::Entry* entry) {
+    if (entry->owner != thr->get_uid()) {
+      entry->clock.update(thr);
+      entry->owner = 0;
+      entry->owner_version = 0;
+    } else if (entry->owner_version == thr->get_version()) {
+      entry->clock.update(thr->get_tid(), thr->return_own_id());
     } else {
-      new_thread =
-          threads.emplace(tid, std::make_shared<ThreadState>(tid, parent))
-              .first->second;
+      entry->clock.vc = thr->vc;
+      entry->owner_version = thr->get_version();
     }
+  }
 
-    return new_thread.get();
+  /// drops the unused happens-before identifiers if the table grew enough
+  /// (amortized by the creation of identifiers)
+  inline void collect_sync_states() {
+    if (max_sync_age != 0 && happens_states.should_collect()) {
+      happens_states.collect(max_sync_age);
+    }
   }
 
-  /// creates a happens_before object
-  inline auto create_happens(void* identifier) {
-    return happens_states
-        .emplace(std::piecewise_construct, std::forward_as_tuple(identifier),
-                 std::forward_as_tuple())
-        .first;
+  /// invalidate the access caches of all threads
+  inline void invalidate_caches() {
+    free_generation.fetch_add(1, std::memory_order_release);
   }
 
-  /// creates an allocation object
-  inline void create_alloc(size_t addr, size_t size) {
-    allocs.emplace(addr, size);
+  /**
+   * \brief creates a new thread object (is called when fork() called)
+   *
+   * Each thread gets a dense slot which is used as index in all vector
+   * clocks, hence the clocks stay small even for large OS thread ids.
+   */
+  ThreadState* create_thread(tid_ft tid, ts_ptr parent = nullptr) {
+    VectorClock<>::Clock start_clock;
+    const auto slot = slots.acquire(&start_clock);
+    ts_ptr new_thread =
+        threads
+            .emplace(tid, std::make_shared<ThreadState>(slot, parent, tid,
+                                                        start_clock))
+            .first->second;
+    slots.bind(slot, new_thread.get());
+    if constexpr (is_tree_clock<ClockT>::value) {
+      if (slot < retired_clocks.size()) {
+        new_thread->inherit(retired_clocks[slot]);
+        retired_clocks[slot] = ClockT();
+      }
+    }
+    return new_thread.get();
+  }
+
+  /**
+   * \brief removes a finished thread from the global tables
+   *
+   * The entries of the thread in the other clocks are kept, hence this is
+   * O(1). They are superseded when the slot is reused. Queued races are
+   * reported before, as they are dropped once the slot is released.
+   *
+   * \note Invariant: requires g_lock
+   */
+  void remove_thread(tid_ft tid) {
+    drain_races();
+    auto it = threads.find(tid);
+    if (it == threads.end()) return;
+    const auto slot = it->second->get_tid();
+    slots.release(slot, it->second->get_clock());
+    if constexpr (is_tree_clock<ClockT>::value) {
+      if (retired_clocks.size() <= slot) {
+        retired_clocks.resize(static_cast<size_t>(slot) + 1);
+      }
+      retired_clocks[slot] = std::move(static_cast<ClockT&>(*it->second));
+    }
+    threads.erase(it);
   }
 
   /// print statistics about rule-hits
@@ -331,6 +527,12 @@ class Fasttrack : public Detector {
     w_ex = (log_count.write_exclusive / write_actions) * 100;
     w_sh = (log_count.write_shared / write_actions) * 100;
 
+    // accesses which were skipped by the access cache are not counted above
+    const double all_accesses =
+        read_actions + write_actions + log_count.cache_same_epoch;
+    const double c_se = (log_count.cache_same_epoch / all_accesses) * 100;
+    const double c_var = (log_count.cache_var / all_accesses) * 100;
+
     std::cout << "FASTTRACK_STATISTICS: All values are percentages!"
               << std::endl;
     std::cout << std::fixed << std::setprecision(2) << "Read Actions: " << rd
@@ -356,115 +558,177 @@ class Fasttrack : public Detector {
               << "Write exclusive: " << w_ex << std::endl;
     std::cout << std::fixed << std::setprecision(2) << "Write shared: " << w_sh
               << std::endl;
-  }
-
-  /**
-   * \brief deletes all data which is related to the tid
-   *
-   * is called when a thread finishes (either from \ref join() or from \ref
-   * finish())
-   *
-   * \note Not Threadsafe
-   */
-  void cleanup(uint32_t tid) {
-    {
-      for (auto it = locks.begin(); it != locks.end(); ++it) {
-        it->second.delete_vc(tid);
-      }
-
-      for (auto it = threads.begin(); it != threads.end(); ++it) {
-        it->second->delete_vc(tid);
-      }
-
-      for (auto it = happens_states.begin(); it != happens_states.end(); ++it) {
-        it->second.delete_vc(tid);
-      }
+    std::cout << std::endl;
+    std::cout << "Access cache (of all accesses): " << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+              << "Hit same epoch: " << c_se << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+              << "Hit variable: " << c_var << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+              << "Miss: " << (100 - c_se - c_var) << std::endl;
+
+    const auto eviction = vars.eviction_stats();
+    if (eviction.evicted != 0) {
+      const double ev_rate =
+          (static_cast<double>(eviction.evicted) / eviction.created) * 100;
+      std::cout << std::endl;
+      std::cout << "Evicted variables: " << eviction.evicted << " ("
+                << std::fixed << std::setprecision(2) << ev_rate
+                << " of created)" << std::endl;
+      std::cout << "Re-accessed after eviction (lost history): "
+                << eviction.lost_history << std::endl;
+    }
+    const size_t dropped_stacks = StackDepot::instance().dropped();
+    if (dropped_stacks != 0) {
+      std::cout << std::endl;
+      std::cout << "Stacks not stored (stack depot full): " << dropped_stacks
+                << std::endl;
     }
   }
 
   void parse_args(int argc, const char** argv) {
+    unsigned num_shards = Policy::VarTableT::default_shards;
+    size_t max_shadow_mb = 0;
     int processed = 1;
     while (processed < argc) {
       if (strcmp(argv[processed], "--stats") == 0) {
         log_flag = true;
-        return;
-      } else {
-        ++processed;
+      } else if (strcmp(argv[processed], "--async-reports") == 0) {
+        // report races on a dedicated thread
+        async_reports = threads_allowed;
+      } else if (strcmp(argv[processed], "--shards") == 0 &&
+                 processed + 1 < argc) {
+        // number of shards of the vars table (rounded up to a power of 2)
+        int value = atoi(argv[++processed]);
+        if (value > 0) {
+          num_shards = static_cast<unsigned>(value);
+        }
+      } else if (strcmp(argv[processed], "--sync-max-age") == 0 &&
+                 processed + 1 < argc) {
+        // drop happens-before identifiers which were not used recently
+        int value = atoi(argv[++processed]);
+        if (value > 0) {
+          max_sync_age = static_cast<uint32_t>(value);
+        }
+      } else if (strcmp(argv[processed], "--max-shadow-mb") == 0 &&
+                 processed + 1 < argc) {
+        // bound the memory of the vars table, cold variables are evicted
+        int value = atoi(argv[++processed]);
+        if (value > 0) {
+          max_shadow_mb = static_cast<size_t>(value);
+        }
+      } else if (strcmp(argv[processed], "--max-stack-mb") == 0 &&
+                 processed + 1 < argc) {
+        // bound the memory of the (process-wide) stack depot
+        int value = atoi(argv[++processed]);
+        if (value > 0) {
+          StackDepot::instance().set_max_nodes(
+              (static_cast<size_t>(value) << 20) / StackDepot::bytes_per_node);
+        }
       }
+      ++processed;
+    }
+    vars.resize(num_shards);
+    if (max_shadow_mb != 0) {
+      vars.set_max_vars((max_shadow_mb << 20) /
+                        Policy::VarTableT::bytes_per_var);
     }
   }
 
  public:
-  explicit Fasttrack() = default;
+  /**
+   * \param threads_allowed false if the detector must not spawn threads, e.g.
+   *        inside a DynamoRIO client. Then races are always reported on the
+   *        detecting thread.
+   */
+  explicit Fasttrack(bool threads_allowed = true)
+      : threads_allowed(threads_allowed) {}
+
+  ~Fasttrack() { stop_reporter(); }
 
   bool init(int argc, const char** argv, Callback rc_clb, void* context) final {
     parse_args(argc, argv);
     clb = rc_clb;  // init callback
     clb_context = context;
+    if (async_reports) {
+      reporter_stop.store(false, std::memory_order_relaxed);
+      reporter = std::thread(&Fasttrack::reporter_main, this);
+    }
     return true;
   }
 
   void finalize() final {
+    stop_reporter();
     std::lock_guard<LockT> lg1(g_lock);
-    {
-      std::lock_guard<ipc::spinlock> lg2(vars_spl);
-      vars.clear();
-    }
+    drain_races();
+    queued_races.clear();
+    // the shadow states release their read-shared clocks one by one, then
+    // the variable states and the read-shared table are dropped in bulk
+    shadow.clear();
+    vars.clear();
     locks.clear();
     happens_states.clear();
     allocs.clear();
     threads.clear();
+    slots.clear();
+    retired_clocks.clear();
+    invalidate_caches();
 
-    if (log_flag) {
+    if (stats_enabled()) {
       process_log_output();
     }
   }
 
   void read(tls_t tls, void* pc, void* addr, size_t size) final {
     ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
-    thr->get_stackDepot().set_read_write((size_t)(addr),
-                                         reinterpret_cast<size_t>(pc));
-    VarState* var;
+    const uint64_t gen = free_generation.load(std::memory_order_acquire);
+    VarState* var = get_cached_var(thr, (size_t)addr, false, gen);
+    if (var == nullptr) {
+      return;  // read same epoch, the recorded access stays valid
+    }
+    const uint32_t hist =
+        thr->get_stackDepot().record_access(reinterpret_cast<size_t>(pc));
     {
-      std::lock_guard<ipc::spinlock> exLockT(vars_spl);
-      auto it = vars.find((size_t)(addr));
-      if (it == vars.end()) {  // create new variable if new
-#if MAKE_OUTPUT
-        std::cout << "variable is read before written" << std::endl;  // warning
-#endif
-        it = create_var((size_t)(addr), size);
-      }
-      var = &(it->second);
+      std::lock_guard<VarState> lg(*var);
+      read(thr, var, (size_t)addr, size, hist);
     }
-    std::lock_guard<ipc::spinlock> lg(var->lock);
-    read(thr, var, (size_t)addr);
+    thr->get_accessCache().fill((size_t)addr, var, thr->return_own_id(), gen,
+                                false);
+    flush_races();
   }
 
   void write(tls_t tls, void* pc, void* addr, size_t size) final {
     ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
-    thr->get_stackDepot().set_read_write((size_t)addr,
-                                         reinterpret_cast<size_t>(pc));
-    VarState* var;
+    const uint64_t gen = free_generation.load(std::memory_order_acquire);
+    VarState* var = get_cached_var(thr, (size_t)addr, true, gen);
+    if (var == nullptr) {
+      return;  // write same epoch
+    }
+    const uint32_t hist =
+        thr->get_stackDepot().record_access(reinterpret_cast<size_t>(pc));
     {
-      std::lock_guard<ipc::spinlock> exLockT(vars_spl);
-      auto it = vars.find((size_t)addr);
-      if (it == vars.end()) {
-        it = create_var((size_t)(addr), size);
-      }
-      var = &(it->second);
+      std::lock_guard<VarState> lg(*var);
+      write(thr, var, (size_t)addr, size, hist);
     }
-    std::lock_guard<ipc::spinlock> lg(var->lock);
-    write(thr, var, (size_t)addr);
+    thr->get_accessCache().fill((size_t)addr, var, thr->return_own_id(), gen,
+                                true);
+    flush_races();
   }
 
+  // without stack tracking, the stacks stay empty and only the pc of the
+  // access is recorded
   void func_enter(tls_t tls, void* pc) final {
-    ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
-    thr->get_stackDepot().push_stack_element(reinterpret_cast<size_t>(pc));
+    if constexpr (Policy::track_stacks) {
+      ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
+      thr->get_stackDepot().push_stack_element(reinterpret_cast<size_t>(pc));
+    }
   }
 
   void func_exit(tls_t tls) final {
-    ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
-    thr->get_stackDepot().pop_stack_element();
+    if constexpr (Policy::track_stacks) {
+      ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
+      thr->get_stackDepot().pop_stack_element();
+    }
   }
 
   void fork(tid_t parent, tid_t child, tls_t* tls) final {
@@ -473,10 +737,10 @@ class Fasttrack : public Detector {
     std::lock_guard<LockT> exLockT(g_lock);
     auto thrit = threads.find(parent);
     if (thrit != threads.end()) {
-      {
-        thrit->second->inc_vc();  // inc vector clock for creation of new thread
-      }
-      thr = create_thread(child, threads[parent]);
+      // fork might be called by the child, while the parent synchronizes
+      std::lock_guard<ipc::spinlock> lg(thrit->second->get_clockLock());
+      thrit->second->inc_vc();  // inc vector clock for creation of new thread
+      thr = create_thread(child, thrit->second);
     } else {
       thr = create_thread(child);
     }
@@ -491,10 +755,10 @@ class Fasttrack : public Detector {
     // However, after an application fault like in the howto,
     // at least one thread is joined multiple times
     if (del_thread_it == threads.end() || parent_it == threads.end()) {
-#if MAKE_OUTPUT
-      std::cerr << "invalid thread IDs in join (" << parent << "," << child
-                << ")" << std::endl;
-#endif
+      if constexpr (Policy::verbose) {
+        std::cerr << "invalid thread IDs in join (" << parent << "," << child
+                  << ")" << std::endl;
+      }
       return;
     }
 
@@ -502,9 +766,11 @@ class Fasttrack : public Detector {
     ts_ptr par_thread = parent_it->second;
     del_thread->inc_vc();
     // pass incremented clock of deleted thread to parent
-    par_thread->update(*del_thread);
-    threads.erase(del_thread_it);
-    cleanup(child);
+    {
+      std::lock_guard<ipc::spinlock> lg(par_thread->get_clockLock());
+      par_thread->update(*del_thread);
+    }
+    remove_thread(child);
   }
 
   // sync thread vc to lock vc
@@ -515,93 +781,112 @@ class Fasttrack : public Detector {
                // may have updated the lock
     }
 
-    std::lock_guard<LockT> exLockT(g_lock);
-    auto it = locks.find(mutex);
-    if (it == locks.end()) {
-      it = createLock(mutex);
-    }
+    // the global lock is not required, as only the mutex state and the
+    // clock of the calling thread are involved
+    auto* lock = locks.get_or_create(mutex);
     ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
-    (thr)->update(it->second);
+    std::lock_guard<ipc::spinlock> lg(lock->lock);
+    std::lock_guard<ipc::spinlock> lg_thr(thr->get_clockLock());
+    if constexpr (!is_tree_clock<ClockT>::value) {
+      if (lock->owner == thr->get_uid()) {
+        return;  // the lock clock is already known to the thread
+      }
+      (thr)->update(lock->clock);
+      lock->owner = thr->get_uid();
+      lock->owner_version = 0;
+    } else {
+      (thr)->update(lock->clock);
+    }
   }
 
   void release(tls_t tls, void* mutex, bool write) final {
-    std::lock_guard<LockT> exLockT(g_lock);
-    auto it = locks.find(mutex);
-    if (it == locks.end()) {
-#if MAKE_OUTPUT
-      std::cerr << "lock is released but was never acquired by any thread"
-                << std::endl;
-#endif
-      createLock(mutex);
+    bool created;
+    auto* lock = locks.get_or_create(mutex, &created);
+    if (created) {
+      if constexpr (Policy::verbose) {
+        std::cerr << "lock is released but was never acquired by any thread"
+                  << std::endl;
+      }
       return;  // as lock is empty (was never acquired), we can return here
     }
 
     ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
+    std::lock_guard<ipc::spinlock> lg(lock->lock);
+    std::lock_guard<ipc::spinlock> lg_thr(thr->get_clockLock());
     thr->inc_vc();
 
     // increase vector clock and propagate to lock
-    it->second.update(thr);
+    if constexpr (!is_tree_clock<ClockT>::value) {
+      release_clock(thr, lock);
+    } else {
+      // tree clocks already copy only the changed entries
+      lock->clock.update(thr);
+    }
   }
 
   void happens_before(tls_t tls, void* identifier) final {
-    std::lock_guard<LockT> exLockT(g_lock);
-    auto it = happens_states.find(identifier);
-    if (it == happens_states.end()) {
-      it = create_happens(identifier);
+    bool created;
+    {
+      auto* state = happens_states.get_or_create(identifier, &created);
+      ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
+
+      std::lock_guard<ipc::spinlock> lg(state->lock);
+      std::lock_guard<ipc::spinlock> lg_thr(thr->get_clockLock());
+      thr->inc_vc();  // increment clock of thread and update happens state
+      if constexpr (is_tree_clock<ClockT>::value) {
+        // tree clocks have to be transitively closed, publish the full clock
+        state->clock.update(thr);
+      } else {
+        state->clock.update(thr->get_tid(), thr->return_own_id());
+      }
+    }
+    if (created) {
+      collect_sync_states();
     }
-
-    ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
-
-    thr->inc_vc();  // increment clock of thread and update happens state
-    it->second.update(thr->get_tid(), thr->return_own_id());
   }
 
   void happens_after(tls_t tls, void* identifier) final {
-    {
-      std::lock_guard<LockT> exLockT(g_lock);
-      auto it = happens_states.find(identifier);
-      if (it == happens_states.end()) {
-        create_happens(identifier);
-        return;  // create -> no happens_before can be synced
-      } else {
-        ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
-        // update vector clock of thread with happened before clocks
-        thr->update(it->second);
-      }
+    bool created;
+    auto* state = happens_states.get_or_create(identifier, &created);
+    if (created) {
+      collect_sync_states();
+      return;  // create -> no happens_before can be synced
     }
+    ThreadState* thr = reinterpret_cast<ThreadState*>(tls);
+    std::lock_guard<ipc::spinlock> lg(state->lock);
+    std::lock_guard<ipc::spinlock> lg_thr(thr->get_clockLock());
+    // update vector clock of thread with happened before clocks
+    thr->update(state->clock);
   }
 
   void allocate(tls_t tls, void* pc, void* addr, size_t size) final {
-#if REGARD_ALLOCS
-    size_t address = reinterpret_cast<size_t>(addr);
-    std::lock_guard<LockT> exLockT(g_lock);
-    if (allocs.find(address) == allocs.end()) {
-      create_alloc(address, size);
+    if constexpr (Policy::track_allocs) {
+      size_t address = reinterpret_cast<size_t>(addr);
+      std::lock_guard<LockT> exLockT(g_lock);
+      allocs.insert(address, size);
     }
-#endif
   }
 
   void deallocate(tls_t tls, void* addr) final {
-#if REGARD_ALLOCS
-    size_t address = reinterpret_cast<size_t>(addr);
-    size_t end_addr;
+    if constexpr (Policy::track_allocs) {
+      HeapBlocks::Block block;
 
-    std::lock_guard<LockT> exLockT(g_lock);
-    end_addr = address + allocs[address];
-
-    // variable is deallocated so varstate objects can be destroyed
-    while (address < end_addr) {
-      std::lock_guard<ipc::spinlock> lg(vars_spl);
-      if (vars.find(address) != vars.end()) {
-        auto& var = vars.find(address)->second;
-        vars.erase(address);
-        address++;
-      } else {
-        address++;
+      std::lock_guard<LockT> exLockT(g_lock);
+      if (!allocs.remove(reinterpret_cast<size_t>(addr), &block)) {
+        return;  // not tracked
       }
+
+      // variable is deallocated so varstate objects can be destroyed, the
+      // cells of shadowed blocks are reset directly
+      if (!shadow.reset(block.begin, block.size)) {
+        vars.erase_range(block.begin, block.end());
+      }
+      // mutexes and happens-before identifiers of the block are dead as well
+      locks.erase_range(block.begin, block.end());
+      happens_states.erase_range(block.begin, block.end());
+      // after the reset, as accesses in between might cache the old state
+      invalidate_caches();
     }
-    allocs.erase(address);
-#endif
   }
 
   void detach(tls_t tls, tid_t thread_id) final {
@@ -612,16 +897,23 @@ class Fasttrack : public Detector {
   void finish(tls_t tls, tid_t thread_id) final {
     std::lock_guard<LockT> exLockT(g_lock);
     /// just delete thread from list, no backward sync needed
-    threads.erase(thread_id);
-    cleanup(thread_id);
+    remove_thread(thread_id);
   }
 
   /**
-   * \note allocation of shadow memory is not required in this
-   *       detector. If a standalone version of Fasttrack is used
-   *       this function can be ignored
+   * \brief map a region of application memory to direct-mapped shadow memory
+   *
+   * Accesses to mapped regions are tracked per (start) byte, like in the
+   * vars table, but do not require the vars table. Regions which cannot be
+   * mapped (e.g. too large) are silently tracked in the vars table.
+   * \note the DRace client does not call this yet, only standalone users of
+   *       the detector interface benefit from the shadow memory
    */
-  void map_shadow(void* startaddr, size_t size_in_bytes) final { return; }
+  void map_shadow(void* startaddr, size_t size_in_bytes) final {
+    shadow.map_region(startaddr, size_in_bytes);
+    // cached states of the region are now superseded by the shadow cells
+    invalidate_caches();
+  }
 
   const char* name() final { return "FASTTRACK"; }
 
@@ -0,0 +1,94 @@
+#ifndef HEAPBLOCKS_H
+#define HEAPBLOCKS_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <iterator>
+#include <map>
+
+/**
+ * \brief Interval index of the live heap blocks
+ *
+ * The blocks are ordered by their start address and never overlap, hence
+ * the block containing an address is found in O(log n).
+ *
+ * \note Not Threadsafe
+ */
+class HeapBlocks {
+ public:
+  struct Block {
+    size_t begin{0};
+    size_t size{0};
+
+    inline size_t end() const { return begin + size; }
+  };
+
+ private:
+  /// start address -> size
+  std::map<size_t, size_t> _blocks;
+
+ public:
+  /**
+   * \brief add a block
+   *
+   * Blocks overlapping the new one have been freed without notice (e.g. by
+   * a missed deallocation) and are dropped.
+   * \return false if a block with the same start already exists
+   */
+  bool insert(size_t begin, size_t size) {
+    auto it = _blocks.find(begin);
+    if (it != _blocks.end()) return false;
+
+    it = _blocks.lower_bound(begin);
+    if (it != _blocks.begin()) {
+      auto prev = std::prev(it);
+      if (prev->first + prev->second > begin) {
+        it = prev;
+      }
+    }
+    while (it != _blocks.end() && it->first < begin + size) {
+      it = _blocks.erase(it);
+    }
+    _blocks.emplace_hint(it, begin, size);
+    return true;
+  }
+
+  /**
+   * \brief find the block which contains addr
+   * \return false if addr is not part of a live block
+   */
+  bool find(size_t addr, Block* block) const {
+    auto it = _blocks.upper_bound(addr);
+    if (it == _blocks.begin()) return false;
+    --it;
+    if (addr >= it->first + it->second) return false;
+    block->begin = it->first;
+    block->size = it->second;
+    return true;
+  }
+
+  /**
+   * \brief remove the block starting at begin
+   * \return false if there is no such block
+   */
+  bool remove(size_t begin, Block* block) {
+    auto it = _blocks.find(begin);
+    if (it == _blocks.end()) return false;
+    block->begin = it->first;
+    block->size = it->second;
+    _blocks.erase(it);
+    return true;
+  }
+
+  size_t size() const { return _blocks.size(); }
+
+  void clear() { _blocks.clear(); }
+};
+
+#endif  // !HEAPBLOCKS_H
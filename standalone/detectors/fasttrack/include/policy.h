@@ -0,0 +1,53 @@
+#ifndef POLICY_H
+#define POLICY_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "vartable.h"
+
+namespace drace {
+namespace detector {
+
+/**
+ * \brief Compile-time configuration of the \ref Fasttrack detector
+ *
+ * Disabled features are removed from the code paths, hence a specialized
+ * detector does not pay for checks of features it does not use. Policies
+ * are derived from \ref DefaultPolicy and override single members.
+ */
+struct DefaultPolicy {
+  /// track the call stacks (func_enter, func_exit). Otherwise, only the
+  /// pc of the racy accesses is reported.
+  static constexpr bool track_stacks = true;
+  /// track heap blocks to report them and to drop the states of freed
+  /// memory. Otherwise, reused memory might lead to false positives.
+  static constexpr bool track_allocs = true;
+  /// count the rule hits, printed on finalize if enabled with --stats
+  static constexpr bool collect_stats = true;
+  /// print diagnostics about unexpected calls (e.g. unknown threads)
+  static constexpr bool verbose = false;
+  /// table of the variables outside of the shadow memory
+  using VarTableT = VarTable;
+};
+
+/// without call stacks (drace.detector.fasttrack.nostack)
+struct NoStackPolicy : DefaultPolicy {
+  static constexpr bool track_stacks = false;
+};
+
+/// cheapest variant, only detects races (drace.detector.fasttrack.minimal)
+struct MinimalPolicy : DefaultPolicy {
+  static constexpr bool track_stacks = false;
+  static constexpr bool track_allocs = false;
+  static constexpr bool collect_stats = false;
+};
+
+}  // namespace detector
+}  // namespace drace
+
+#endif  // !POLICY_H
@@ -0,0 +1,162 @@
+#ifndef RACEQUEUE_H
+#define RACEQUEUE_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "vectorclock.h"
+
+/**
+ * \brief A detected race which is not yet reported
+ *
+ * The stacks are captured by their history ids (see \ref StackDepot), the
+ * threads by their slot, hence no allocation besides the record itself is
+ * required on detection.
+ */
+struct PendingRace {
+  VectorClock<>::VC_ID id1;
+  uint32_t hist1;
+  uint32_t thr2;
+  uint32_t hist2;
+  bool wr1;
+  bool wr2;
+  size_t address;
+  size_t size;
+  std::atomic<PendingRace*> next{nullptr};
+};
+
+/**
+ * \brief Lock-free multi-producer single-consumer queue of detected races
+ *
+ * Intrusive queue by D. Vyukov: a push is a single exchange, hence the
+ * detecting threads never block. Only one thread at a time may pop.
+ */
+class RaceQueue {
+  PendingRace _stub{};
+  /// last pushed element (producers)
+  std::atomic<PendingRace*> _head{&_stub};
+  /// next element to pop (consumer)
+  PendingRace* _tail{&_stub};
+  std::atomic<size_t> _pending{0};
+
+  void push_node(PendingRace* race) {
+    race->next.store(nullptr, std::memory_order_relaxed);
+    PendingRace* prev = _head.exchange(race, std::memory_order_acq_rel);
+    prev->next.store(race, std::memory_order_release);
+  }
+
+ public:
+  RaceQueue() = default;
+  RaceQueue(const RaceQueue&) = delete;
+  RaceQueue& operator=(const RaceQueue&) = delete;
+
+  ~RaceQueue() {
+    while (PendingRace* race = pop()) {
+      delete race;
+    }
+  }
+
+  /**
+   * \brief append a race, takes ownership
+   * \return true if the queue was empty before
+   * \note threadsafe
+   */
+  bool push(PendingRace* race) {
+    push_node(race);
+    return _pending.fetch_add(1, std::memory_order_release) == 0;
+  }
+
+  /**
+   * \brief remove the oldest race, the caller takes ownership
+   * \return nullptr if the queue is empty or a push is not yet completed
+   * \note single consumer only
+   */
+  PendingRace* pop() {
+    PendingRace* tail = _tail;
+    PendingRace* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &_stub) {
+      if (next == nullptr) return nullptr;
+      _tail = next;
+      tail = next;
+      next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+      _tail = next;
+      _pending.fetch_sub(1, std::memory_order_relaxed);
+      return tail;
+    }
+    if (tail != _head.load(std::memory_order_acquire)) {
+      return nullptr;  // producer is between exchange and link
+    }
+    // tail is the last element, re-insert the stub to detach it
+    push_node(&_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      _tail = next;
+      _pending.fetch_sub(1, std::memory_order_relaxed);
+      return tail;
+    }
+    return nullptr;
+  }
+
+  /// number of queued races (might be outdated immediately)
+  inline size_t pending() const {
+    return _pending.load(std::memory_order_acquire);
+  }
+};
+
+/**
+ * \brief Lossy filter of recently reported races
+ *
+ * Direct-mapped table of race signatures (history ids and address). A race
+ * is a duplicate if its signature is in the table. On collisions, the older
+ * signature is replaced, hence duplicates might pass but distinct races
+ * are never dropped. Lock-free and without allocations.
+ */
+class RaceFilter {
+ public:
+  static constexpr unsigned table_bits = 12;
+
+ private:
+  std::array<std::atomic<uint64_t>, 1u << table_bits> _table{};
+
+  static inline uint64_t signature(uint32_t hist1, uint32_t hist2,
+                                   size_t address) {
+    uint64_t h = (static_cast<uint64_t>(hist1) << 32 | hist2) *
+                 0x9E3779B97F4A7C15ull;
+    h ^= static_cast<uint64_t>(address) + 0x7F4A7C159E3779B9ull + (h << 6) +
+         (h >> 2);
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 31;
+    return h != 0 ? h : 1;  // 0 marks an empty entry
+  }
+
+ public:
+  /**
+   * \brief checks and records a race
+   * \return true if the race has been recorded before
+   * \note threadsafe
+   */
+  bool test_and_set(uint32_t hist1, uint32_t hist2, size_t address) {
+    const uint64_t sig = signature(hist1, hist2, address);
+    auto& entry = _table[sig >> (64 - table_bits)];
+    if (entry.load(std::memory_order_relaxed) == sig) return true;
+    return entry.exchange(sig, std::memory_order_relaxed) == sig;
+  }
+
+  void clear() {
+    for (auto& entry : _table) {
+      entry.store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+#endif  // !RACEQUEUE_H
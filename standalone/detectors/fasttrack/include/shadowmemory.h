@@ -0,0 +1,213 @@
+#ifndef SHADOWMEMORY_H
+#define SHADOWMEMORY_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <ipc/spinlock.h>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>  // for lock_guard
+#include <new>
+
+/**
+ * \brief Direct-mapped shadow memory
+ *
+ * Maps each application byte of a registered region to a shadow cell of
+ * type \c T using plain address arithmetic. Each region holds a table of
+ * chunk pointers (first level), the chunks (second level) are allocated
+ * lazily on the first access into their address range.
+ *
+ * Lookups do not take any lock. Only mapping a new region is serialized.
+ *
+ * \note like the vars table, a cell is keyed by the start address of an
+ *       access, hence accesses to neighbouring bytes never share a cell
+ * \tparam T type of a shadow cell (has to be default constructible)
+ * \tparam ChunkBits log2 of the application bytes covered by a chunk
+ */
+template <typename T, unsigned ChunkBits = 16>
+class ShadowMemory {
+ public:
+  /// number of application bytes which are mapped to a single cell
+  static constexpr size_t granularity = 1;
+  /// number of application bytes covered by a single chunk
+  static constexpr size_t chunk_bytes = static_cast<size_t>(1) << ChunkBits;
+  static constexpr size_t cells_per_chunk = chunk_bytes / granularity;
+  /// maximum number of regions which can be mapped
+  static constexpr unsigned max_regions = 64;
+  /// largest region that is accepted (larger ones are rejected)
+  static constexpr size_t max_region_size = static_cast<size_t>(1)
+                                            << (sizeof(void*) == 8 ? 40 : 31);
+
+ private:
+  struct Chunk {
+    std::array<T, cells_per_chunk> cells;
+  };
+
+  struct Region {
+    uintptr_t begin{0};
+    uintptr_t end{0};
+    std::unique_ptr<std::atomic<Chunk*>[]> chunks;
+    size_t num_chunks{0};
+  };
+
+  std::array<Region, max_regions> _regions;
+  /// regions are only appended, hence readers just need a consistent count
+  std::atomic<unsigned> _num_regions{0};
+  /// serializes calls to \ref map_region
+  ipc::spinlock _map_lock;
+  /// number of allocated chunks (statistics only)
+  std::atomic<size_t> _num_chunks{0};
+
+  /// returns the region containing addr or nullptr
+  inline const Region* find_region(uintptr_t addr) const {
+    const unsigned num = _num_regions.load(std::memory_order_acquire);
+    for (unsigned i = 0; i < num; ++i) {
+      const Region& r = _regions[i];
+      if (addr >= r.begin && addr < r.end) return &r;
+    }
+    return nullptr;
+  }
+
+  /// allocate a chunk and publish it, or return the one of a faster thread
+  Chunk* populate(std::atomic<Chunk*>& slot) {
+    Chunk* expected = nullptr;
+    Chunk* chunk = new Chunk();
+    if (slot.compare_exchange_strong(expected, chunk,
+                                     std::memory_order_acq_rel)) {
+      _num_chunks.fetch_add(1, std::memory_order_relaxed);
+      return chunk;
+    }
+    delete chunk;
+    return expected;
+  }
+
+ public:
+  ShadowMemory() = default;
+  ShadowMemory(const ShadowMemory&) = delete;
+  ShadowMemory& operator=(const ShadowMemory&) = delete;
+
+  ~ShadowMemory() { clear(); }
+
+  /**
+   * \brief register a block of application memory
+   * \return false if the block is too large, overlaps an already mapped
+   *         region or no more regions can be mapped
+   */
+  bool map_region(void* startaddr, size_t size_in_bytes) {
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(startaddr);
+    if (size_in_bytes == 0 || size_in_bytes > max_region_size ||
+        begin + size_in_bytes < begin) {
+      return false;
+    }
+
+    std::lock_guard<ipc::spinlock> lg(_map_lock);
+    const unsigned num = _num_regions.load(std::memory_order_relaxed);
+    if (num == max_regions) return false;
+    for (unsigned i = 0; i < num; ++i) {
+      if (begin < _regions[i].end &&
+          _regions[i].begin < begin + size_in_bytes) {
+        return false;
+      }
+    }
+
+    Region& r = _regions[num];
+    r.begin = begin;
+    r.end = begin + size_in_bytes;
+    r.num_chunks = (size_in_bytes + chunk_bytes - 1) / chunk_bytes;
+    // value-initialized, hence all chunks are nullptr
+    r.chunks = std::make_unique<std::atomic<Chunk*>[]>(r.num_chunks);
+    _num_regions.store(num + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// returns true if addr is inside a mapped region
+  inline bool is_mapped(uintptr_t addr) const {
+    return find_region(addr) != nullptr;
+  }
+
+  /**
+   * \brief returns the shadow cell of addr, or nullptr if addr is not mapped
+   * \note lock-free, populates the chunk on first access
+   */
+  inline T* find(uintptr_t addr) {
+    const Region* r = find_region(addr);
+    if (r == nullptr) return nullptr;
+
+    const uintptr_t offset = addr - r->begin;
+    std::atomic<Chunk*>& slot = r->chunks[offset >> ChunkBits];
+    Chunk* chunk = slot.load(std::memory_order_acquire);
+    if (chunk == nullptr) {
+      chunk = populate(slot);
+    }
+    return &(chunk->cells[(offset & (chunk_bytes - 1)) / granularity]);
+  }
+
+  /**
+   * \brief reset all cells of the given range to their initial state
+   *
+   * Chunks which have never been accessed are skipped, hence the cost is
+   * proportional to the populated part of the range.
+   * \return false, if the range is not (completely) mapped
+   */
+  bool reset(uintptr_t begin, size_t size) {
+    const Region* r = find_region(begin);
+    if (r == nullptr || begin + size > r->end) return false;
+
+    uintptr_t addr = begin;
+    const uintptr_t end = begin + size;
+    while (addr < end) {
+      const uintptr_t offset = addr - r->begin;
+      const uintptr_t chunk_end =
+          r->begin + (offset & ~(chunk_bytes - 1)) + chunk_bytes;
+      const uintptr_t stop = chunk_end < end ? chunk_end : end;
+
+      Chunk* chunk =
+          r->chunks[offset >> ChunkBits].load(std::memory_order_acquire);
+      if (chunk != nullptr) {
+        size_t first = (offset & (chunk_bytes - 1)) / granularity;
+        size_t last = ((stop - 1 - r->begin) & (chunk_bytes - 1)) / granularity;
+        for (size_t i = first; i <= last; ++i) {
+          T* cell = &(chunk->cells[i]);
+          cell->~T();
+          new (cell) T();
+        }
+      }
+      addr = stop;
+    }
+    return true;
+  }
+
+  /**
+   * \brief free all chunks and unmap all regions
+   * \note not threadsafe
+   */
+  void clear() {
+    const unsigned num = _num_regions.load(std::memory_order_acquire);
+    for (unsigned i = 0; i < num; ++i) {
+      Region& r = _regions[i];
+      for (size_t c = 0; c < r.num_chunks; ++c) {
+        delete r.chunks[c].load(std::memory_order_relaxed);
+      }
+      r.chunks.reset();
+      r.begin = r.end = 0;
+      r.num_chunks = 0;
+    }
+    _num_regions.store(0, std::memory_order_release);
+    _num_chunks.store(0, std::memory_order_relaxed);
+  }
+
+  /// number of populated chunks
+  size_t num_chunks() const {
+    return _num_chunks.load(std::memory_order_relaxed);
+  }
+};
+
+#endif  // !SHADOWMEMORY_H
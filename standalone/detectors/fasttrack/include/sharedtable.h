@@ -0,0 +1,228 @@
+#ifndef SHAREDTABLE_H
+#define SHAREDTABLE_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <ipc/spinlock.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>  // for lock_guard
+#include <new>
+#include <vector>
+#include "vectorclock.h"
+#include "vectorops.h"
+
+/**
+ * \brief Clocks of the readers of a read-shared variable
+ *
+ * The entries are stored as struct of arrays, hence the tids and the clocks
+ * can be searched using vector instructions. Up to InlineReaders entries
+ * are stored inline, only more readers spill to the heap. Hence, most
+ * read-shared variables do not allocate.
+ *
+ * \tparam InlineReaders number of readers without allocation
+ */
+template <uint32_t InlineReaders>
+class ReadSharedClockT {
+ public:
+  using TID = VectorClock<>::TID;
+  using Clock = VectorClock<>::Clock;
+  using VC_ID = VectorClock<>::VC_ID;
+
+ private:
+  uint32_t _size{0};
+  uint32_t _capacity{InlineReaders};
+  uint32_t* _tids{_inline_tids.data()};
+  uint32_t* _clocks{_inline_clocks.data()};
+  /// history ids of the reads (see \ref StackTrace::record_access)
+  uint32_t* _hists{_inline_hists.data()};
+  /// spilled entries (tids, clocks, hists), if more than InlineReaders
+  std::unique_ptr<uint32_t[]> _heap;
+  std::array<uint32_t, InlineReaders> _inline_tids;
+  std::array<uint32_t, InlineReaders> _inline_clocks;
+  std::array<uint32_t, InlineReaders> _inline_hists;
+
+  /// move the entries to a heap buffer of the given capacity
+  void grow(uint32_t capacity) {
+    std::unique_ptr<uint32_t[]> heap(new uint32_t[3 * size_t(capacity)]);
+    uint32_t* tids = heap.get();
+    uint32_t* clocks = tids + capacity;
+    uint32_t* hists = clocks + capacity;
+    std::copy(_tids, _tids + _size, tids);
+    std::copy(_clocks, _clocks + _size, clocks);
+    std::copy(_hists, _hists + _size, hists);
+    _heap = std::move(heap);
+    _tids = tids;
+    _clocks = clocks;
+    _hists = hists;
+    _capacity = capacity;
+  }
+
+ public:
+  ReadSharedClockT() = default;
+  // the pointers refer to the inline storage
+  ReadSharedClockT(const ReadSharedClockT&) = delete;
+  ReadSharedClockT& operator=(const ReadSharedClockT&) = delete;
+
+  inline size_t size() const { return _size; }
+
+  inline bool empty() const { return _size == 0; }
+
+  /// remove all entries, keeps the capacity
+  inline void clear() { _size = 0; }
+
+  inline void reserve(size_t n) {
+    if (n > _capacity) {
+      grow(static_cast<uint32_t>(n));
+    }
+  }
+
+  /// returns the position of tid, \ref size() if not found
+  inline size_t find(TID tid) const {
+    return vectorops::find(_tids, _size, tid);
+  }
+
+  /// stores the epoch id, updates the entry of the same thread in place
+  inline void set(VC_ID id, uint32_t hist = 0) {
+    const TID tid = VectorClock<>::make_tid(id);
+    const Clock clk = VectorClock<>::make_clock(id);
+    const size_t pos = find(tid);
+    if (pos != size()) {
+      _clocks[pos] = static_cast<uint32_t>(clk);
+      _hists[pos] = hist;
+      return;
+    }
+    if (_size == _capacity) {
+      grow(2 * _capacity);
+    }
+    _tids[_size] = static_cast<uint32_t>(tid);
+    _clocks[_size] = static_cast<uint32_t>(clk);
+    _hists[_size] = hist;
+    ++_size;
+  }
+
+  inline TID tid_at(size_t pos) const { return static_cast<TID>(_tids[pos]); }
+
+  inline Clock clock_at(size_t pos) const {
+    return static_cast<Clock>(_clocks[pos]);
+  }
+
+  inline uint32_t hist_at(size_t pos) const { return _hists[pos]; }
+
+  /// returns the epoch id of the entry at pos
+  inline VC_ID id_at(size_t pos) const {
+    return VectorClock<>::make_id(tid_at(pos)) + clock_at(pos);
+  }
+
+  /// true if the entries spilled to the heap
+  inline bool spilled() const { return _heap != nullptr; }
+
+  const uint32_t* tids() const { return _tids; }
+  const uint32_t* clocks() const { return _clocks; }
+};
+
+/// most variables are read-shared by only a few threads
+using ReadSharedClock = ReadSharedClockT<4>;
+
+/**
+ * \brief Side table for the read-shared clocks of variables
+ *
+ * Only a small fraction of all variables is ever read-shared. Hence, a
+ * \ref VarState just stores a pointer to an entry of this table instead of
+ * owning the vector itself. Each entry knows its table, hence it is
+ * released to the table it was allocated from.
+ *
+ * Entries are stored in chunks that are never moved, hence a reference to
+ * an entry stays valid until the entry is released. Allocation and release
+ * of entries are serialized. Each detector has its own table (see
+ * \ref VarTable::shared_table), which is dropped at once with \ref clear.
+ */
+class ReadSharedTable {
+ public:
+  /// read-shared clocks of a variable
+  class Entry : public ReadSharedClock {
+    friend class ReadSharedTable;
+    ReadSharedTable* _table{nullptr};
+
+   public:
+    /// the table this entry belongs to
+    ReadSharedTable* table() const { return _table; }
+  };
+
+  static constexpr unsigned chunk_bits = 12;
+  static constexpr uint32_t chunk_size = 1u << chunk_bits;
+
+ private:
+  struct Chunk {
+    std::array<Entry, chunk_size> entries;
+  };
+
+  std::vector<std::unique_ptr<Chunk>> _chunks;
+  /// released entries
+  std::vector<Entry*> _free;
+  /// next never used entry of the last chunk
+  uint32_t _next{chunk_size};
+  ipc::spinlock _lock;
+
+ public:
+  ReadSharedTable() = default;
+  ReadSharedTable(const ReadSharedTable&) = delete;
+  ReadSharedTable& operator=(const ReadSharedTable&) = delete;
+
+  /**
+   * \brief allocate an empty entry
+   * \throws std::bad_alloc if no chunk can be allocated
+   */
+  Entry* allocate() {
+    std::lock_guard<ipc::spinlock> lg(_lock);
+    if (!_free.empty()) {
+      Entry* entry = _free.back();
+      _free.pop_back();
+      return entry;
+    }
+    if (_next == chunk_size) {
+      _chunks.push_back(std::make_unique<Chunk>());
+      _next = 0;
+    }
+    Entry* entry = &(_chunks.back()->entries[_next++]);
+    entry->_table = this;
+    return entry;
+  }
+
+  /// release an entry, the entry keeps its capacity for later re-use
+  void release(Entry* entry) {
+    entry->clear();
+    std::lock_guard<ipc::spinlock> lg(_lock);
+    _free.push_back(entry);
+  }
+
+  /**
+   * \brief release all entries at once
+   *
+   * Costs O(allocated entries), i.e. only the read-shared variables are
+   * visited, not all variables.
+   * \warning not threadsafe, the entries must not be used anymore
+   */
+  void clear() {
+    std::lock_guard<ipc::spinlock> lg(_lock);
+    _chunks.clear();
+    _free.clear();
+    _next = chunk_size;
+  }
+
+  /// number of entries currently in use
+  size_t size() {
+    std::lock_guard<ipc::spinlock> lg(_lock);
+    if (_chunks.empty()) return 0;
+    return (_chunks.size() - 1) * chunk_size + _next - _free.size();
+  }
+};
+
+#endif  // !SHAREDTABLE_H
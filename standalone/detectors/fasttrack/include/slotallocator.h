@@ -0,0 +1,101 @@
+#ifndef SLOTALLOCATOR_H
+#define SLOTALLOCATOR_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <vector>
+#include "vectorclock.h"
+
+/**
+ * \brief Maps threads to the dense slots which index the vector clocks
+ *
+ * Slots of finished threads are reused. The clock of a slot is never reset:
+ * a new owner starts with the clock following the last clock of the previous
+ * owner. Hence, stale entries of the previous owner which remain in other
+ * clocks are always smaller than any epoch of the new owner and never
+ * order its accesses. By that, no clock has to be touched when a thread
+ * finishes and the length of all clocks is bounded by the maximum number of
+ * concurrently running threads.
+ *
+ * Slot 0 is reserved, as epochs of slot 0 and clock 0 mark uninitialized
+ * variables.
+ *
+ * \note Not Threadsafe
+ */
+template <typename OwnerT>
+class SlotAllocator {
+ public:
+  using TID = VectorClock<>::TID;
+  using Clock = VectorClock<>::Clock;
+
+ private:
+  struct Slot {
+    OwnerT* owner{nullptr};
+    /// first clock of the current (or next) owner
+    Clock start_clock{0};
+  };
+
+  std::vector<Slot> _slots{1};
+  /// released slots, reused in LIFO order
+  std::vector<TID> _free;
+
+ public:
+  /**
+   * \brief reserve a slot
+   * \param start_clock is set to the first clock the new owner has to use
+   */
+  TID acquire(Clock* start_clock) {
+    TID slot;
+    if (!_free.empty()) {
+      slot = _free.back();
+      _free.pop_back();
+    } else {
+      slot = static_cast<TID>(_slots.size());
+      _slots.emplace_back();
+    }
+    *start_clock = _slots[slot].start_clock;
+    return slot;
+  }
+
+  /// set the owner of an acquired slot
+  void bind(TID slot, OwnerT* owner) { _slots[slot].owner = owner; }
+
+  /**
+   * \brief release the slot of a finished thread
+   * \param last_clock last clock the owner used (and might have published)
+   */
+  void release(TID slot, Clock last_clock) {
+    _slots[slot].owner = nullptr;
+    _slots[slot].start_clock = last_clock + 1;
+    _free.push_back(slot);
+  }
+
+  /// returns the current owner of the slot or nullptr if it is not in use
+  inline OwnerT* owner(TID slot) const {
+    return slot < _slots.size() ? _slots[slot].owner : nullptr;
+  }
+
+  /// returns the first clock of the current owner of the slot
+  inline Clock start_clock(TID slot) const {
+    return _slots[slot].start_clock;
+  }
+
+  /// number of slots which have ever been used (upper bound of clock length)
+  size_t size() const { return _slots.size() - 1; }
+
+  /// number of slots currently in use
+  size_t num_used() const { return size() - _free.size(); }
+
+  /// release all slots and reset the clocks
+  void clear() {
+    _slots.assign(1, Slot());
+    _free.clear();
+  }
+};
+
+#endif  // !SLOTALLOCATOR_H
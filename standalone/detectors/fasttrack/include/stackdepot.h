@@ -0,0 +1,250 @@
+#ifndef STACKDEPOT_H
+#define STACKDEPOT_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <thread>
+
+#ifdef HAVE_SSE2
+#include <immintrin.h>  //_mm_pause
+#endif
+
+/**
+ * \brief Process-wide store of all call stacks
+ *
+ * The stacks are hash-consed as a prefix tree: each node is the pair
+ * (parent stack, pc) and is stored only once, independent of the thread
+ * which uses it. Hence, a stack is identified by a stable 32-bit id and the
+ * memory scales with the number of unique code paths. Id 0 is the empty
+ * stack.
+ *
+ * Lookups are lock-free. Inserts lock only the hash bucket (msb of the
+ * bucket head), similar to the StackDepot of ThreadSanitizer.
+ *
+ * Nodes are never removed, as the ids are stored lock-free in the access
+ * histories. Instead, the number of nodes is capped (see
+ * \ref set_max_nodes), hence the memory stays bounded for long-running
+ * processes. When the depot is full, known stacks are still found, but new
+ * stacks are not stored and are reported as empty (id 0).
+ */
+class StackDepot {
+ public:
+  using StackId = uint32_t;
+
+  static constexpr unsigned chunk_bits = 16;
+  static constexpr uint32_t chunk_size = 1u << chunk_bits;
+  /// the msb of an id is used as bucket lock
+  static constexpr uint32_t max_chunks = 1u << (31 - chunk_bits);
+  static constexpr unsigned table_bits = 18;
+  /// default cap of the nodes (192 MiB on 64-bit)
+  static constexpr uint32_t default_max_nodes = 128 * chunk_size;
+
+ private:
+  static constexpr uint32_t LOCK_BIT = 1u << 31;
+
+  struct Node {
+    size_t pc;
+    StackId parent;
+    /// number of frames of this stack
+    uint32_t depth;
+    /// next node in the same hash bucket
+    StackId next;
+  };
+
+  struct Chunk {
+    std::array<Node, chunk_size> nodes;
+  };
+
+  std::array<std::atomic<Chunk*>, max_chunks> _chunks{};
+  /// heads of the hash buckets, 0 terminates a bucket
+  std::unique_ptr<std::atomic<StackId>[]> _table{
+      new std::atomic<StackId>[size_t(1) << table_bits]()};
+  /// next unused id
+  std::atomic<StackId> _next{1};
+  /// maximum number of nodes, i.e. the largest id
+  std::atomic<StackId> _max_nodes{default_max_nodes};
+  /// number of stacks which were not stored as the depot was full
+  std::atomic<size_t> _dropped{0};
+
+  static inline uint32_t hash(StackId parent, size_t pc) {
+    const uint64_t h = (static_cast<uint64_t>(pc) ^
+                        (static_cast<uint64_t>(parent) << 32)) *
+                       0x9E3779B97F4A7C15ull;
+    return static_cast<uint32_t>(h >> (64 - table_bits));
+  }
+
+  inline const Node& node(StackId id) const {
+    return _chunks[id >> chunk_bits]
+        .load(std::memory_order_acquire)
+        ->nodes[id & (chunk_size - 1)];
+  }
+
+  inline Node& node(StackId id) {
+    return const_cast<Node&>(static_cast<const StackDepot*>(this)->node(id));
+  }
+
+  /// searches the bucket chain starting at head
+  inline StackId find(StackId head, StackId parent, size_t pc) const {
+    for (StackId id = head; id != 0; id = node(id).next) {
+      const Node& n = node(id);
+      if (n.pc == pc && n.parent == parent) return id;
+    }
+    return 0;
+  }
+
+  /// reserves a new node, allocates the chunk if required
+  /// \return 0 if the depot is full or the chunk cannot be allocated
+  StackId allocate() {
+    StackId id = _next.load(std::memory_order_relaxed);
+    do {
+      if (id > _max_nodes.load(std::memory_order_relaxed)) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+      }
+    } while (!_next.compare_exchange_weak(id, id + 1,
+                                          std::memory_order_relaxed));
+    auto& chunk = _chunks[id >> chunk_bits];
+    if (chunk.load(std::memory_order_acquire) == nullptr) {
+      Chunk* expected = nullptr;
+      Chunk* fresh = new (std::nothrow) Chunk();
+      if (fresh == nullptr) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+      }
+      if (!chunk.compare_exchange_strong(expected, fresh,
+                                         std::memory_order_acq_rel)) {
+        delete fresh;  // allocated concurrently
+      }
+    }
+    return id;
+  }
+
+  static inline void pause(int spin_count) {
+    if (spin_count < 16) {
+#ifdef HAVE_SSE2
+      _mm_pause();
+#endif
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+ public:
+  StackDepot() {
+    // node 0 is the empty stack
+    _chunks[0].store(new Chunk(), std::memory_order_release);
+    node(0) = Node{0, 0, 0, 0};
+  }
+
+  StackDepot(const StackDepot&) = delete;
+  StackDepot& operator=(const StackDepot&) = delete;
+
+  ~StackDepot() {
+    for (auto& c : _chunks) {
+      delete c.load(std::memory_order_relaxed);
+    }
+  }
+
+  /// process-wide instance used by all threads
+  static StackDepot& instance() {
+    static StackDepot depot;
+    return depot;
+  }
+
+  /**
+   * \brief bound the number of stored stacks
+   *
+   * A lower value than the current size stops the growth, but keeps the
+   * stored stacks.
+   * \param max_nodes maximum number of nodes, 0 for the largest possible
+   */
+  void set_max_nodes(size_t max_nodes) {
+    // the id of the last node must not overlap the lock bit
+    const size_t limit = size_t(chunk_size) * max_chunks - 1;
+    if (max_nodes == 0 || max_nodes > limit) {
+      max_nodes = limit;
+    }
+    _max_nodes.store(static_cast<StackId>(max_nodes),
+                     std::memory_order_relaxed);
+  }
+
+  /**
+   * \brief returns the id of the stack parent + pc, inserts it if new
+   * \return 0 (the empty stack) if the stack is new and the depot is full
+   */
+  StackId intern(StackId parent, size_t pc) {
+    std::atomic<StackId>& bucket = _table[hash(parent, pc)];
+    StackId head = bucket.load(std::memory_order_acquire);
+    StackId id = find(head & ~LOCK_BIT, parent, pc);
+    if (id != 0) return id;
+
+    // lock the bucket and search again, as the stack might have been
+    // inserted in the meantime
+    for (int spin_count = 0;; ++spin_count) {
+      head = bucket.load(std::memory_order_relaxed);
+      if (!(head & LOCK_BIT) &&
+          bucket.compare_exchange_weak(head, head | LOCK_BIT,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed)) {
+        break;
+      }
+      pause(spin_count);
+    }
+    id = find(head, parent, pc);
+    if (id == 0) {
+      id = allocate();
+      if (id != 0) {
+        node(id) = Node{pc, parent, node(parent).depth + 1, head};
+        head = id;
+      }
+    }
+    // publish the node and unlock
+    bucket.store(head, std::memory_order_release);
+    return id;
+  }
+
+  /// returns the stack without the innermost frame
+  inline StackId parent(StackId id) const { return node(id).parent; }
+
+  /// returns the innermost frame of the stack
+  inline size_t pc(StackId id) const { return node(id).pc; }
+
+  /// returns the number of frames of the stack
+  inline uint32_t depth(StackId id) const { return node(id).depth; }
+
+  /**
+   * \brief copy the innermost frames of a stack, the outermost first
+   * \return number of copied frames (at most max)
+   */
+  size_t get_frames(StackId id, uintptr_t* out, size_t max) const {
+    const size_t num = depth(id) < max ? depth(id) : max;
+    for (size_t i = num; i-- > 0;) {
+      const Node& n = node(id);
+      out[i] = static_cast<uintptr_t>(n.pc);
+      id = n.parent;
+    }
+    return num;
+  }
+
+  /// number of stored nodes (unique stack prefixes)
+  size_t size() const { return _next.load(std::memory_order_relaxed) - 1; }
+
+  /// number of new stacks which were not stored, as the depot was full
+  size_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+  /// memory of a stored node
+  static constexpr size_t bytes_per_node = sizeof(Node);
+};
+
+#endif  // !STACKDEPOT_H
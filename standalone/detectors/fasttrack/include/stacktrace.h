@@ -11,81 +11,80 @@
  * SPDX-License-Identifier: MIT
  */
 
-#include <ipc/spinlock.h>
-#include <parallel_hashmap/phmap.h>
-#include <boost/graph/adjacency_list.hpp>
+#include <cstdint>
 #include <list>
+#include "stackdepot.h"
 
 /**
- * \brief Implements a stack depot capable to store callstacks
- *        with references to particular nodes.
+ * \brief Tracks the callstack of a single thread
+ *
+ * The stacks are interned in the process-wide \ref StackDepot, hence this
+ * class only holds the id of the current stack and push and pop are O(1)
+ * lookups in the depot. Threads executing the same code paths share the
+ * stacks.
+ *
+ * An access is recorded as a leaf (pc of the access) below the current
+ * stack. The id of this stack is the history id of the access, which is
+ * stored in the \ref VarState. As the depot never removes stacks, history
+ * ids stay valid forever. If the depot is full, the frames which could not
+ * be stored are counted instead and the accesses below them have no
+ * history (id 0).
+ *
+ * \note Not Threadsafe: only the owning thread modifies the stack
  */
 class StackTrace {
-  /// Store the address along with each vertex
-  struct VertexProperty {
-    size_t addr;
-  };
-  typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::bidirectionalS,
-                                VertexProperty>
-      StackTree;
-
-  /// holds var_address, pc, stack_length
-  phmap::flat_hash_map<size_t, std::pair<size_t, StackTree::vertex_descriptor>>
-      _read_write;
-
-  /// holds to complete stack tree
-  /// is needed to create the stack trace in case of a race
-  /// leafs of the tree which do not have pointer pointing to them may be
-  /// deleted
-  StackTree _local_stack;
-
-  /// reference to the current stack element
-  StackTree::vertex_descriptor _ce;
-
-  /// reference to the root element
-  StackTree::vertex_descriptor _root;
-
-  uint16_t _pop_count = 0;
-
-  mutable ipc::spinlock lock;
-
-  /// re-construct a stack-trace from a bottom node to the root
-  std::list<size_t> make_trace(
-      const std::pair<size_t, StackTree::vertex_descriptor>& data) const;
+ public:
+  /// id of a recorded access, 0 if not available
+  using HistoryId = StackDepot::StackId;
 
-  /**
-   * \brief cleanup unreferenced nodes in callstack tree
-   * \warning very expensive
-   */
-  void clean();
+ private:
+  /// id of the current stack in the depot
+  StackDepot::StackId _ce = 0;
+  /// number of frames on top of _ce which are not in the depot
+  uint32_t _unknown = 0;
 
  public:
-  StackTrace() : _ce(boost::add_vertex({0}, _local_stack)), _root(_ce) {}
-
   /**
    * \brief pop the last element from the stack
-   * \note precondition: stack is not empty
-   * \note threadsafe
+   * \note popping an empty stack keeps it empty
    */
-  void pop_stack_element();
+  inline void pop_stack_element() {
+    if (_unknown != 0) {
+      --_unknown;
+      return;
+    }
+    _ce = StackDepot::instance().parent(_ce);
+  }
 
-  /**
-   * \brief push a new element to the stack depot
-   * \note threadsafe
-   */
-  void push_stack_element(size_t element);
+  /// push a new element to the stack
+  inline void push_stack_element(size_t element) {
+    if (_unknown == 0) {
+      const StackDepot::StackId id =
+          StackDepot::instance().intern(_ce, element);
+      if (id != 0) {
+        _ce = id;
+        return;
+      }
+    }
+    ++_unknown;  // the depot is full
+  }
 
   /**
-   * when a var is written or read, it copies the stack and adds the pc of the
-   * r/w operation to be able to return the stack trace if a race was detected
-   * \note threadsafe
+   * when a var is written or read, the pc of the r/w operation is appended
+   * to the current stack to be able to return the stack trace if a race was
+   * detected
+   * \return history id of the access
    */
-  void set_read_write(size_t addr, size_t pc);
+  inline HistoryId record_access(size_t pc) const {
+    if (_unknown != 0) return 0;
+    return StackDepot::instance().intern(_ce, pc);
+  }
 
   /**
-   * \brief returns a stack trace of a clock for handing it over to drace
+   * \brief returns the stack trace of a recorded access, empty if the id
+   *        is 0
    * \note threadsafe
    */
-  std::list<size_t> return_stack_trace(size_t address) const;
+  static std::list<size_t> return_stack_trace(HistoryId id);
 };
 #endif
@@ -0,0 +1,318 @@
+#ifndef SYNCTABLE_H
+#define SYNCTABLE_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <ipc/spinlock.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>  // for lock_guard
+#include <vector>
+#include "parallel_hashmap/phmap.h"
+
+/**
+ * \brief Sharded table of the clocks of synchronization objects
+ *        (mutexes, happens-before identifiers)
+ *
+ * The shard lock only protects the lookup. Each object has its own lock
+ * which protects its clock, hence operations on different objects never
+ * serialize (except for the short lookup in the same shard).
+ *
+ * Entries are dropped if the memory of the object is freed
+ * (\ref erase_range) or if the object was not used during the last
+ * collections (\ref collect). As the entries are used after the shard lock
+ * is released, dropped entries are kept in a quarantine before they are
+ * deleted (similar to the evicted states of the \ref VarTable).
+ */
+template <class ClockT>
+class SyncTable {
+ public:
+  static constexpr unsigned num_shards_log2 = 6;
+  static constexpr unsigned num_shards = 1u << num_shards_log2;
+  /// objects are indexed per page to find them in freed memory
+  static constexpr unsigned page_bits = 12;
+  /// size of the table which triggers the first collection
+  static constexpr size_t min_collect_size = 1024;
+
+  struct Entry {
+    /// protects the clock (order: 2, after the global lock)
+    ipc::spinlock lock;
+    ClockT clock;
+    /// unique id of a thread whose clock includes this clock, 0 if unknown
+    uint64_t owner{0};
+    /// version of the owner's clock when this clock was copied from it,
+    /// i.e. both clocks only differ in the entry of the owner (0 if not)
+    uint64_t owner_version{0};
+    /// last collection epoch in which the entry was looked up
+    uint32_t last_used{0};
+  };
+
+  /// number of dropped entries per shard which are not deleted yet
+  static constexpr size_t quarantine_size = 256;
+
+ private:
+  /// padded to a cache line to avoid false sharing of the locks
+  struct alignas(64) Shard {
+    ipc::spinlock lock;
+    phmap::flat_hash_map<void*, std::unique_ptr<Entry>> entries;
+    std::deque<std::unique_ptr<Entry>> quarantine;
+  };
+
+  std::unique_ptr<Shard[]> _shards{std::make_unique<Shard[]>(num_shards)};
+
+  /// objects per page, never locked together with a shard lock
+  ipc::spinlock _pages_lock;
+  phmap::flat_hash_map<size_t, std::vector<void*>> _pages;
+
+  std::atomic<size_t> _size{0};
+  /// current collection epoch
+  std::atomic<uint32_t> _epoch{0};
+  /// size of the table which triggers the next collection
+  std::atomic<size_t> _collect_size{min_collect_size};
+  ipc::spinlock _collect_lock;
+
+  /// fibonacci hashing of the address to spread neighbouring objects
+  inline Shard& get_shard(void* obj) const {
+    const uint64_t hash = static_cast<uint64_t>(reinterpret_cast<size_t>(obj)) *
+                          0x9E3779B97F4A7C15ull;
+    return _shards[hash >> (64 - num_shards_log2)];
+  }
+
+  static inline size_t page_of(void* obj) {
+    return reinterpret_cast<size_t>(obj) >> page_bits;
+  }
+
+  void index(void* obj) {
+    std::lock_guard<ipc::spinlock> lg(_pages_lock);
+    _pages[page_of(obj)].push_back(obj);
+  }
+
+  void unindex(void* obj) {
+    std::lock_guard<ipc::spinlock> lg(_pages_lock);
+    auto page = _pages.find(page_of(obj));
+    if (page == _pages.end()) return;
+    auto& objs = page->second;
+    for (size_t i = 0; i < objs.size(); ++i) {
+      if (objs[i] == obj) {
+        objs[i] = objs.back();
+        objs.pop_back();
+        break;
+      }
+    }
+    if (objs.empty()) {
+      _pages.erase(page);
+    }
+  }
+
+  /// moves the indexed objects of the page in [begin, end) to out
+  /// \note Invariant: requires the pages lock
+  static void take_page(std::vector<void*>& objs, size_t begin, size_t end,
+                        std::vector<void*>* out) {
+    for (size_t i = 0; i < objs.size();) {
+      const size_t addr = reinterpret_cast<size_t>(objs[i]);
+      if (addr >= begin && addr < end) {
+        out->push_back(objs[i]);
+        objs[i] = objs.back();
+        objs.pop_back();
+      } else {
+        ++i;
+      }
+    }
+  }
+
+  /// moves the entry to the quarantine
+  /// \note Invariant: requires the shard lock
+  static void retire(Shard& shard, std::unique_ptr<Entry>&& entry) {
+    shard.quarantine.push_back(std::move(entry));
+    if (shard.quarantine.size() > quarantine_size) {
+      shard.quarantine.pop_front();
+    }
+  }
+
+  /// drops the entry of obj, without updating the index
+  bool drop(void* obj) {
+    Shard& shard = get_shard(obj);
+    std::lock_guard<ipc::spinlock> lg(shard.lock);
+    auto it = shard.entries.find(obj);
+    if (it == shard.entries.end()) {
+      return false;
+    }
+    retire(shard, std::move(it->second));
+    shard.entries.erase(it);
+    _size.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+ public:
+  /// returns the entry of obj, nullptr if not found
+  inline Entry* find(void* obj) {
+    Shard& shard = get_shard(obj);
+    std::lock_guard<ipc::spinlock> lg(shard.lock);
+    auto it = shard.entries.find(obj);
+    if (it == shard.entries.end()) {
+      return nullptr;
+    }
+    it->second->last_used = _epoch.load(std::memory_order_relaxed);
+    return it->second.get();
+  }
+
+  /**
+   * \brief returns the entry of obj, creates it if new
+   * \param created is set to true if the entry was created
+   */
+  inline Entry* get_or_create(void* obj, bool* created = nullptr) {
+    Shard& shard = get_shard(obj);
+    bool inserted;
+    Entry* entry;
+    {
+      std::lock_guard<ipc::spinlock> lg(shard.lock);
+      auto res = shard.entries.try_emplace(obj);
+      inserted = res.second;
+      if (inserted) {
+        try {
+          res.first->second = std::make_unique<Entry>();
+        } catch (...) {
+          shard.entries.erase(res.first);
+          throw;
+        }
+      }
+      entry = res.first->second.get();
+      entry->last_used = _epoch.load(std::memory_order_relaxed);
+    }
+    if (inserted) {
+      _size.fetch_add(1, std::memory_order_relaxed);
+      index(obj);
+    }
+    if (created != nullptr) {
+      *created = inserted;
+    }
+    return entry;
+  }
+
+  /// removes the entry of obj
+  inline bool erase(void* obj) {
+    if (!drop(obj)) {
+      return false;
+    }
+    unindex(obj);
+    return true;
+  }
+
+  /**
+   * \brief removes the entries of the objects in [begin, end), e.g. of a
+   *        freed heap block
+   * \return number of removed entries
+   */
+  size_t erase_range(size_t begin, size_t end) {
+    if (begin >= end || _size.load(std::memory_order_relaxed) == 0) {
+      return 0;
+    }
+    std::vector<void*> objs;
+    {
+      std::lock_guard<ipc::spinlock> lg(_pages_lock);
+      const size_t first = begin >> page_bits;
+      const size_t last = (end - 1) >> page_bits;
+      if (last - first < _pages.size()) {
+        for (size_t p = first; p <= last; ++p) {
+          auto page = _pages.find(p);
+          if (page == _pages.end()) continue;
+          take_page(page->second, begin, end, &objs);
+          if (page->second.empty()) {
+            _pages.erase(page);
+          }
+        }
+      } else {
+        // range is larger than the index
+        for (auto page = _pages.begin(); page != _pages.end();) {
+          if (page->first >= first && page->first <= last) {
+            take_page(page->second, begin, end, &objs);
+          }
+          if (page->second.empty()) {
+            _pages.erase(page++);
+          } else {
+            ++page;
+          }
+        }
+      }
+    }
+    size_t num = 0;
+    for (void* obj : objs) {
+      if (drop(obj)) {
+        ++num;
+      }
+    }
+    return num;
+  }
+
+  /// true if the table grew enough since the last collection
+  inline bool should_collect() const {
+    return _size.load(std::memory_order_relaxed) >=
+           _collect_size.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * \brief starts a new epoch and removes the entries which were not used
+   *        during the last max_age epochs
+   *
+   * The next collection is triggered (see \ref should_collect) when the
+   * table doubled its size, hence the collections are amortized by the
+   * creation of entries. If another thread is collecting, this is a no-op.
+   * \return number of removed entries
+   */
+  size_t collect(uint32_t max_age) {
+    std::unique_lock<ipc::spinlock> collect_lg(_collect_lock,
+                                               std::try_to_lock);
+    if (!collect_lg.owns_lock()) {
+      return 0;
+    }
+    const uint32_t epoch = _epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+    std::vector<void*> erased;
+    for (unsigned i = 0; i < num_shards; ++i) {
+      Shard& shard = _shards[i];
+      std::lock_guard<ipc::spinlock> lg(shard.lock);
+      for (auto it = shard.entries.begin(); it != shard.entries.end();) {
+        if (epoch - it->second->last_used > max_age) {
+          erased.push_back(it->first);
+          retire(shard, std::move(it->second));
+          shard.entries.erase(it++);
+        } else {
+          ++it;
+        }
+      }
+    }
+    _size.fetch_sub(erased.size(), std::memory_order_relaxed);
+    for (void* obj : erased) {
+      unindex(obj);
+    }
+    _collect_size.store(
+        std::max(2 * _size.load(std::memory_order_relaxed), min_collect_size),
+        std::memory_order_relaxed);
+    return erased.size();
+  }
+
+  /// drop all entries
+  void clear() {
+    for (unsigned i = 0; i < num_shards; ++i) {
+      std::lock_guard<ipc::spinlock> lg(_shards[i].lock);
+      _shards[i].entries.clear();
+      _shards[i].quarantine.clear();
+    }
+    std::lock_guard<ipc::spinlock> lg(_pages_lock);
+    _pages.clear();
+    _size.store(0, std::memory_order_relaxed);
+    _collect_size.store(min_collect_size, std::memory_order_relaxed);
+  }
+
+  /// number of tracked objects
+  size_t size() const { return _size.load(std::memory_order_relaxed); }
+};
+
+#endif  // !SYNCTABLE_H
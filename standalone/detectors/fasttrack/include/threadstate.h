@@ -11,46 +11,103 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <ipc/spinlock.h>
 #include <atomic>
+#include <cstdint>
 #include <memory>
+#include "accesscache.h"
 #include "stacktrace.h"
+#include "treeclock.h"
 #include "vectorclock.h"
 #include "xvector.h"
 
 /// implements a threadstate, holds the thread's vectorclock and the thread's id
 /// (tid and act clock)
-class ThreadState : public VectorClock<> {
+/// \tparam ClockT type of the clock (\ref VectorClock or \ref TreeClock)
+template <class ClockT>
+class ThreadStateT : public ClockT {
+ public:
+  using VC_ID = VectorClock<>::VC_ID;
+  using TID = VectorClock<>::TID;
+  using Clock = VectorClock<>::Clock;
+
  private:
   /// holds the tid and the actual clock value -> lower 32 bits are clock, upper
   /// 32 are the tid
-  std::atomic<VectorClock::VC_ID> id;
+  std::atomic<VC_ID> id;
+  /// thread id of the operating system
+  size_t os_tid;
   StackTrace traceDepot;
+  /// recent accesses of this thread
+  AccessCache accessCache;
+  /// protects the clock during synchronization operations, as fork and join
+  /// might modify it from other threads (order: 3)
+  ipc::spinlock clockLock;
+  /// process-wide unique id of this thread, in contrast to the tid which is
+  /// reused
+  uint64_t uid;
+  /// incremented whenever the clock learns entries of other threads
+  uint64_t version{1};
 
  public:
   /// constructor of ThreadState object, initializes tid and clock
   /// copies the vector of parent thread, if a parent thread exists
-  ThreadState(VectorClock::TID own_tid,
-              const std::shared_ptr<ThreadState>& parent = nullptr);
+  /// \param own_tid compact thread id (slot) used in the vector clocks
+  /// \param os_tid thread id of the OS (defaults to own_tid)
+  /// \param start_clock first clock of this thread (see \ref SlotAllocator)
+  ThreadStateT(TID own_tid,
+               const std::shared_ptr<ThreadStateT>& parent = nullptr,
+               size_t os_tid = 0, Clock start_clock = 0);
+
+  using ClockT::update;
+
+  /// joins other into the clock of this thread
+  void update(const ClockT& other) {
+    ClockT::update(other);
+    ++version;
+  }
+
+  void update(const ClockT* other) { update(*other); }
 
   /// increases own clock value
   void inc_vc();
 
   /// returns own clock value (upper bits) & thread (lower bits)
-  inline VectorClock::VC_ID return_own_id() const { return id; }
+  inline VC_ID return_own_id() const { return id; }
 
   /// returns thread id
-  inline VectorClock::TID get_tid() const { return VectorClock::make_tid(id); }
+  inline TID get_tid() const { return VectorClock<>::make_tid(id); }
+
+  /// returns the thread id of the operating system
+  inline size_t get_os_tid() const { return os_tid; }
+
+  /// returns the unique id of this thread (never 0)
+  inline uint64_t get_uid() const { return uid; }
+
+  /**
+   * \brief returns the version of the clock
+   *
+   * If the version did not change, the clock only differs in the own entry
+   * of this thread.
+   */
+  inline uint64_t get_version() const { return version; }
 
   /// returns current clock
-  inline VectorClock::Clock get_clock() const {
-    return VectorClock::make_clock(id);
-  }
+  inline Clock get_clock() const { return VectorClock<>::make_clock(id); }
 
   /// may be called after exitting of thread
-  inline void delete_vector() { vc.clear(); }
+  inline void delete_vector() { this->vc.clear(); }
 
   /// return stackDepot of this thread
   StackTrace& get_stackDepot() { return traceDepot; }
+
+  /// return the access cache of this thread
+  AccessCache& get_accessCache() { return accessCache; }
+
+  /// return the lock which protects the clock of this thread
+  ipc::spinlock& get_clockLock() { return clockLock; }
 };
 
+using ThreadState = ThreadStateT<VectorClock<>>;
+
 #endif  // !THREADSTATE_H
@@ -0,0 +1,289 @@
+#ifndef TREECLOCK_H
+#define TREECLOCK_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <algorithm>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "vectorclock.h"
+#include "xvector.h"
+
+/**
+ * \brief Vector clock which joins and copies in time proportional to the
+ *        number of entries that actually change
+ *
+ * Additionally to the dense clock values, the entries are arranged in a tree.
+ * The root is the thread which owns the clock (or for a lock, the thread which
+ * released it). A node u below node p with attach clock a(u) records that
+ * everyone who knows clock a(u) of p also knows the clock of u (and everything
+ * u knew at that time). The children of a node are ordered by decreasing
+ * attach clock. As the current clock of a thread might already be published,
+ * entries it learns are attached with its next clock.
+ * When joining another tree clock, subtrees whose root is already known are
+ * skipped, as well as all children which were attached before the known
+ * clock of their parent.
+ *
+ * This requires all clocks to be transitively closed. Hence, a release
+ * always publishes the full clock of the thread and a reused slot has to
+ * inherit the clock of its previous owner (see \ref inherit()).
+ *
+ * Lock clocks which are released by concurrent threads (e.g. shared locks)
+ * cannot keep a root. They fall back to flat joins until they are released
+ * by a thread which knows the whole clock.
+ *
+ * Entries are never deleted, as slots are reused (see \ref SlotAllocator).
+ *
+ * \note Not Threadsafe
+ */
+class TreeClock : public VectorClock<> {
+ private:
+  struct Node {
+    TID parent{0};
+    TID first_child{0};
+    /// next sibling (smaller attach clock)
+    TID next{0};
+    TID prev{0};
+    /// first clock of the parent which includes this node
+    Clock aclk{0};
+  };
+
+  /// tree links, indexed by tid
+  xvector<Node> _nodes;
+  /// root of the tree, 0 for an empty or flat clock
+  TID _root{0};
+  /// true if the clock belongs to the thread in the root
+  bool _owned{false};
+
+  /// scratch storage for the traversal (kept to avoid allocations)
+  std::vector<TID> _updated;
+  std::vector<std::pair<TID, TID>> _frames;
+
+  inline Clock get(TID tid) const { return get_clock_by_tid(tid); }
+
+  inline void grow(size_t size) {
+    if (vc.size() < size) {
+      vc.resize(size, 0);
+    }
+    if (_nodes.size() < size) {
+      _nodes.resize(size);
+    }
+  }
+
+  /// insert u as first (most recently attached) child of p
+  inline void push_child(TID p, TID u) {
+    Node& n = _nodes[u];
+    n.parent = p;
+    n.prev = 0;
+    n.next = _nodes[p].first_child;
+    if (n.next != 0) {
+      _nodes[n.next].prev = u;
+    }
+    _nodes[p].first_child = u;
+  }
+
+  /// unlink u (together with its subtree) from its parent
+  inline void detach(TID u) {
+    Node& n = _nodes[u];
+    if (n.parent == 0) return;
+    if (n.prev != 0) {
+      _nodes[n.prev].next = n.next;
+    } else {
+      _nodes[n.parent].first_child = n.next;
+    }
+    if (n.next != 0) {
+      _nodes[n.next].prev = n.prev;
+    }
+    n.parent = n.prev = n.next = 0;
+  }
+
+  /**
+   * \brief collect all nodes of other (below root z) which are newer than
+   *        the entries of this clock
+   *
+   * The nodes are stored in post-order, hence parents are found after their
+   * children in \ref _updated.
+   */
+  void collect_updated(const TreeClock& other, TID z) {
+    _updated.clear();
+    _frames.clear();
+    _frames.emplace_back(z, other._nodes[z].first_child);
+    while (!_frames.empty()) {
+      const TID u = _frames.back().first;
+      const TID v = _frames.back().second;
+      if (v == 0) {
+        _updated.push_back(u);
+        _frames.pop_back();
+        continue;
+      }
+      const Node& nv = other._nodes[v];
+      _frames.back().second = nv.next;
+      if (get(v) < other.vc[v]) {
+        _frames.emplace_back(v, nv.first_child);
+      } else if (nv.aclk <= get(u)) {
+        // all remaining children are known through u
+        _frames.back().second = 0;
+      }
+    }
+  }
+
+  /// move the collected nodes to the same positions as in other
+  void apply_updated(const TreeClock& other, TID z) {
+    grow(other.vc.size());
+    for (TID u : _updated) {
+      detach(u);
+    }
+    // parents first, siblings with increasing attach clock
+    for (auto it = _updated.rbegin(); it != _updated.rend(); ++it) {
+      const TID u = *it;
+      vc[u] = std::max(vc[u], other.vc[u]);
+      if (u != z) {
+        _nodes[u].aclk = other._nodes[u].aclk;
+        push_child(other._nodes[u].parent, u);
+      }
+    }
+  }
+
+  /// attach a single node directly below the root
+  inline void attach_to_root(TID u, Clock clk) {
+    vc[u] = clk;
+    detach(u);
+    _nodes[u].aclk = vc[_root] + 1;
+    push_child(_root, u);
+  }
+
+  /// pointwise maximum, the result is flat unless the clock is owned
+  void join_flat(const VectorClock<>& other) {
+    if (!_owned) {
+      VectorClock<>::update(other);
+      _root = 0;
+      return;
+    }
+    grow(other.vc.size());
+    for (TID i = 1; i < other.vc.size(); ++i) {
+      if (i != _root && other.vc[i] > vc[i]) {
+        attach_to_root(i, other.vc[i]);
+      }
+    }
+  }
+
+  /// replace this clock by other, which has to be known to other
+  void copy_monotone(const TreeClock& other) {
+    const TID w = _root;
+    const TID z = other._root;
+    collect_updated(other, z);
+    apply_updated(other, z);
+    _root = z;
+    if (w != 0 && w != z && _nodes[w].parent == 0) {
+      // old root is not newer in other, keep it below the new root
+      _nodes[w].aclk = vc[z];
+      push_child(z, w);
+    }
+  }
+
+ public:
+  /// number of entries visited by the last join or copy (for statistics)
+  size_t last_updated() const { return _updated.size(); }
+
+  /// returns the root of the tree, 0 if the clock is flat
+  TID get_root() const { return _root; }
+
+  /**
+   * \brief set the own entry of the thread which owns this clock
+   *
+   * If the thread is not the root yet, it takes over the clock and the
+   * previous tree is attached below it.
+   */
+  void update(TID tid, VC_ID id) {
+    const Clock clk = make_clock(id);
+    grow(static_cast<size_t>(tid) + 1);
+    if (_owned && tid == _root) {
+      vc[tid] = std::max(vc[tid], clk);
+      return;
+    }
+    const TID old = _root;
+    const bool flat = (old == 0);
+    detach(tid);
+    vc[tid] = std::max(vc[tid], clk);
+    _root = tid;
+    _owned = true;
+    if (!flat) {
+      _nodes[old].aclk = vc[tid] + 1;
+      push_child(tid, old);
+      return;
+    }
+    // rebuild the tree of a flat clock
+    _nodes.assign(vc.size(), Node());
+    for (TID i = 1; i < vc.size(); ++i) {
+      if (i != tid && vc[i] != 0) {
+        _nodes[i].aclk = vc[tid] + 1;
+        push_child(tid, i);
+      }
+    }
+  }
+
+  void update(const TreeClock* other) { update(*other); }
+
+  /**
+   * \brief join other into this clock
+   *
+   * For a thread clock, only the entries which are newer in other are
+   * visited. Other clocks (locks, happens-before objects) are replaced by
+   * other, if they are known to other (monotone copy).
+   */
+  void update(const TreeClock& other) {
+    const TID z = other._root;
+    if (other.vc.empty()) return;
+    if (z == 0) {
+      join_flat(other);
+      return;
+    }
+    if (other.vc[z] <= get(z)) {
+      return;  // other is already known
+    }
+
+    if (_owned) {
+      collect_updated(other, z);
+      apply_updated(other, z);
+      _nodes[z].aclk = vc[_root] + 1;
+      push_child(_root, z);
+      return;
+    }
+
+    if (_root == 0 && vc.empty()) {
+      copy_monotone(other);
+    } else if (_root != 0 && other.get(_root) >= vc[_root]) {
+      copy_monotone(other);
+    } else if (_root == 0 && leq(other)) {
+      // flat, but known to other
+      vc = other.vc;
+      _nodes = other._nodes;
+      _root = z;
+    } else {
+      // concurrent releases
+      join_flat(other);
+    }
+  }
+
+  /**
+   * \brief learn the final clock of the previous owner of a reused slot
+   *
+   * The previous owner is treated as if it was the same logical thread.
+   */
+  void inherit(const TreeClock& previous) { join_flat(previous); }
+};
+
+/// clocks which require transitively closed releases (see \ref TreeClock)
+template <class ClockT>
+struct is_tree_clock : std::false_type {};
+
+template <>
+struct is_tree_clock<TreeClock> : std::true_type {};
+
+#endif  // !TREECLOCK_H
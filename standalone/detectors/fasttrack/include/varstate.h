@@ -12,107 +12,193 @@
 #define VARSTATE_H
 
 #include <atomic>
+#include <cstdint>
 #include <memory>
+#include <thread>
+#include "sharedtable.h"
 #include "threadstate.h"
 #include "vectorclock.h"
 #include "xvector.h"
 
+#ifdef HAVE_SSE2
+#include <immintrin.h>  //_mm_pause
+#endif
+
 /**
  * \brief stores information about a memory location
+ *
+ * The state is packed into two words plus the history ids of the last
+ * accesses. The most significant bit of the write epoch is used as lock
+ * bit, the most significant bit of the read epoch tells if the variable is
+ * read-shared. In that case, the lower bits hold the pointer to the
+ * read-shared clocks in the \ref ReadSharedTable (shifted by one bit, as
+ * the entries are aligned).
+ *
+ * The history ids refer to the stack depot of the accessing thread (see
+ * \ref StackTrace::record_access) and are protected by the lock bit.
+ *
  * \note does not store the address to avoid redundant information
+ * \note the msb of the tid is reserved, hence only the lower half of the
+ *       tid range is usable
+ * \note implements the interface of \ref std::mutex
  */
 class VarState {
-  /// contains read_shared case all involved threads and clocks
-  std::unique_ptr<xvector<size_t>> shared_vc{nullptr};
+ public:
+  using VC_ID = VectorClock<>::VC_ID;
+  static constexpr VC_ID VAR_NOT_INIT = 0;
+
+ private:
+  /// flag in w_id (lock bit)
+  static constexpr VC_ID LOCK_BIT = static_cast<VC_ID>(1)
+                                    << (sizeof(VC_ID) * 8 - 1);
+  /// flag in r_id (read-shared bit)
+  static constexpr VC_ID SHARED_BIT = LOCK_BIT;
+  static_assert(sizeof(VC_ID) >= sizeof(uintptr_t) &&
+                    alignof(ReadSharedTable::Entry) >= 2,
+                "the read-shared pointer must fit next to the flag");
 
   /// the upper half of the bits are the thread id the lower half is the clock
-  /// of the thread
-  std::atomic<VectorClock<>::VC_ID> w_id{VAR_NOT_INIT};
-  /// local clock of last read
-  std::atomic<VectorClock<>::VC_ID> r_id{VAR_NOT_INIT};
+  /// of the thread. The msb is used as lock bit.
+  std::atomic<VC_ID> w_id{VAR_NOT_INIT};
+  /// local clock of last read or index of the read-shared clocks
+  std::atomic<VC_ID> r_id{VAR_NOT_INIT};
+  /// history id of the last write
+  uint32_t w_hist{0};
+  /// history id of the last read (when read is not shared)
+  uint32_t r_hist{0};
+
+  /// returns the read-shared clocks, requires read-shared state
+  inline ReadSharedTable::Entry& shared_vc() const {
+    return *reinterpret_cast<ReadSharedTable::Entry*>(
+        (r_id.load(std::memory_order_relaxed) & ~SHARED_BIT) << 1);
+  }
 
-  /// finds the entry with the tid in the shared vectorclock
-  auto find_in_vec(VectorClock<>::TID tid) const;
+  /// releases the read-shared clocks, if any
+  inline void release_shared() {
+    if (is_read_shared()) {
+      ReadSharedTable::Entry& sh_vc = shared_vc();
+      sh_vc.table()->release(&sh_vc);
+    }
+  }
 
  public:
-  static constexpr int VAR_NOT_INIT = 0;
+  inline VarState() = default;
+  VarState(const VarState&) = delete;
+  VarState& operator=(const VarState&) = delete;
+
+  inline ~VarState() { release_shared(); }
 
   /**
-   * \brief spinlock to ensure mutually-excluded access to a single VarState
-   * instance
+   * \brief spin until the lock bit is acquired
    *
-   * \todo this could be space optimized by having a pool of spinlocks
-   *       instead of one per VarState
+   * Accesses to a single variable are short and rarely contended, hence
+   * we use the same strategy as \ref ipc::spinlock.
    */
-  ipc::spinlock lock;
+  inline void lock() noexcept {
+    for (int spin_count = 0; !try_lock(); ++spin_count) {
+      if (spin_count < 16) {
+#ifdef HAVE_SSE2
+        _mm_pause();
+#endif
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
 
-  /// var size \todo make smaller
-  const uint16_t size;
+  inline bool try_lock() noexcept {
+    VC_ID cur = w_id.load(std::memory_order_relaxed);
+    return !(cur & LOCK_BIT) &&
+           w_id.compare_exchange_weak(cur, cur | LOCK_BIT,
+                                      std::memory_order_acquire,
+                                      std::memory_order_relaxed);
+  }
 
-  explicit inline VarState(uint16_t var_size) : size(var_size) {}
+  inline void unlock() noexcept {
+    w_id.fetch_and(~LOCK_BIT, std::memory_order_release);
+  }
 
   /// evaluates for write/write races through this and and access through t
-  bool is_ww_race(ThreadState* t) const;
+  template <class ThreadT>
+  bool is_ww_race(ThreadT* t) const;
 
   /// evaluates for write/read races through this and and access through t
-  bool is_wr_race(ThreadState* t) const;
+  template <class ThreadT>
+  bool is_wr_race(ThreadT* t) const;
 
   /// evaluates for read-exclusive/write races through this and and access
   /// through t
-  bool is_rw_ex_race(ThreadState* t) const;
+  template <class ThreadT>
+  bool is_rw_ex_race(ThreadT* t) const;
 
   /// evaluates for read-shared/write races through this and and access through
   /// t
-  VectorClock<>::TID is_rw_sh_race(ThreadState* t) const;
+  template <class ThreadT>
+  VectorClock<>::TID is_rw_sh_race(ThreadT* t) const;
 
   /// returns id of last write access
-  inline VectorClock<>::VC_ID get_write_id() const {
-    return w_id.load(std::memory_order_relaxed);
+  inline VC_ID get_write_id() const {
+    return w_id.load(std::memory_order_relaxed) & ~LOCK_BIT;
   }
 
   /// returns id of last read access (when read is not shared)
-  inline VectorClock<>::VC_ID get_read_id() const {
-    return r_id.load(std::memory_order_relaxed);
+  inline VC_ID get_read_id() const {
+    VC_ID id = r_id.load(std::memory_order_relaxed);
+    return (id & SHARED_BIT) ? VAR_NOT_INIT : id;
   }
 
+  /// returns the history id of the last write access
+  inline uint32_t get_write_hist() const { return w_hist; }
+
+  /// returns the history id of the last read access (when read is not shared)
+  inline uint32_t get_read_hist() const { return r_hist; }
+
   /// return tid of thread which last wrote this var
   inline VectorClock<>::TID get_w_tid() const {
-    return VectorClock<>::make_tid(w_id.load(std::memory_order_relaxed));
+    return VectorClock<>::make_tid(get_write_id());
   }
 
   /// return tid of thread which last read this var, if not read shared
   inline VectorClock<>::TID get_r_tid() const {
-    return VectorClock<>::make_tid(r_id.load(std::memory_order_relaxed));
+    return VectorClock<>::make_tid(get_read_id());
   }
 
   /// returns clock value of thread of last write access
   inline VectorClock<>::Clock get_w_clock() const {
-    return VectorClock<>::make_clock(w_id.load(std::memory_order_relaxed));
+    return VectorClock<>::make_clock(get_write_id());
   }
 
   /// returns clock value of thread of last read access (returns 0 when read is
   /// shared)
   inline VectorClock<>::Clock get_r_clock() const {
-    return VectorClock<>::make_clock(r_id.load(std::memory_order_relaxed));
+    return VectorClock<>::make_clock(get_read_id());
   }
 
   /// returns true when read is shared
-  bool is_read_shared() const { return (shared_vc == nullptr) ? false : true; }
+  inline bool is_read_shared() const {
+    return (r_id.load(std::memory_order_relaxed) & SHARED_BIT) != 0;
+  }
 
   /// updates the var state because of an new read or write access through an
   /// thread
-  void update(bool is_write, size_t id);
+  /// \param hist history id of the access
+  void update(bool is_write, VC_ID id, uint32_t hist = 0);
 
   /// sets read state to shared
-  void set_read_shared(size_t id);
+  /// \param table table of the detector to allocate the read-shared clocks
+  void set_read_shared(ReadSharedTable& table, VC_ID id, uint32_t hist = 0);
 
   /// if in read_shared state, then returns id of position pos in vector clock
-  VectorClock<>::VC_ID get_sh_id(uint32_t pos) const;
+  VC_ID get_sh_id(uint32_t pos) const;
 
   /// return stored clock value, which belongs to ThreadState t, 0 if not
   /// available
-  VectorClock<>::VC_ID get_vc_by_thr(VectorClock<>::TID t) const;
+  VC_ID get_vc_by_thr(VectorClock<>::TID t) const;
 
   VectorClock<>::Clock get_clock_by_thr(VectorClock<>::TID t) const;
+
+  /// return history id of the read of thread t in read-shared state, 0 if not
+  /// available
+  uint32_t get_hist_by_thr(VectorClock<>::TID t) const;
 };
 #endif  // !VARSTATE_H
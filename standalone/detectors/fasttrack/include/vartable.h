@@ -0,0 +1,482 @@
+#ifndef VARTABLE_H
+#define VARTABLE_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <ipc/spinlock.h>
+#include <util/PoolAllocator.h>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>  // for lock_guard
+#include <new>
+#include <vector>
+#include "parallel_hashmap/phmap.h"
+#include "varstate.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>  // _BitScanForward64
+#endif
+
+/**
+ * \brief Sharded table of variable states
+ *
+ * The addresses are distributed over a power-of-two number of shards,
+ * each having its own lock. Hence, accesses to different shards
+ * never contend.
+ *
+ * All addresses of a page (4 KiB) are placed in the same shard. Per granule
+ * (64 bytes), a bitmask records which addresses are tracked and per page,
+ * a bitmask records which granules are populated. By that, the variables
+ * of a range are removed without probing each byte.
+ *
+ * The VarState objects are allocated from a slab pool per shard, as they are
+ * accessed after the shard lock is released, while the map might grow in
+ * the meantime. The read-shared clocks of the states are allocated from a
+ * \ref ReadSharedTable owned by the table. By that, \ref clear frees whole
+ * arenas and drops the read-shared table at once, instead of destructing
+ * single objects.
+ *
+ * Optionally, the number of variables is bounded (see \ref set_max_vars).
+ * Then, cold variables are evicted using the CLOCK algorithm: lookups set
+ * the reference bit of a variable and the clock hand of the shard evicts
+ * the first variable without it. Evicted states might still be in use by
+ * threads which looked them up before, hence they are reset and kept in a
+ * quarantine before their memory is reused. The quarantine holds at least
+ * one batch of evictions, hence a state is never reused by the eviction
+ * which freed it.
+ */
+class VarTable {
+ public:
+  static constexpr unsigned default_shards = 64;
+  static constexpr unsigned max_shards = 4096;
+  static constexpr unsigned granule_bits = 6;
+  static constexpr size_t granule_size = size_t(1) << granule_bits;
+  /// a page consists of 64 granules
+  static constexpr unsigned page_bits = granule_bits + 6;
+  static constexpr size_t page_size = size_t(1) << page_bits;
+  /// estimated memory per variable (state, index and bitmasks)
+  static constexpr size_t bytes_per_var = 64;
+  /// minimum number of evicted states per shard which are not reused yet
+  static constexpr size_t quarantine_size = 1024;
+
+  /// counters of the bounded mode
+  struct EvictionStats {
+    /// created variable states
+    size_t created{0};
+    /// evicted variable states
+    size_t evicted{0};
+    /// states created for recently evicted addresses, i.e. accesses whose
+    /// history was lost (lower bound)
+    size_t lost_history{0};
+  };
+
+ private:
+  /// number of recently evicted addresses per shard to detect re-accesses
+  static constexpr size_t evicted_filter_size = 256;
+  /// rings with fewer erased entries are not compacted
+  static constexpr size_t min_ring_dead = 64;
+
+  struct Slot {
+    VarState* var;
+    /// reference bit of the CLOCK algorithm
+    bool referenced;
+  };
+
+  /// padded to a cache line to avoid false sharing of the locks
+  struct alignas(64) Shard {
+    ipc::spinlock lock;
+    phmap::flat_hash_map<size_t, Slot> vars;
+    /// tracked addresses per granule (bit i <=> granule base + i)
+    phmap::flat_hash_map<size_t, uint64_t> granules;
+    /// populated granules per page (bit i <=> i-th granule of the page)
+    phmap::flat_hash_map<size_t, uint64_t> pages;
+    /// storage of the variable states
+    util::PoolAllocator<65536> pool;
+
+    /// addresses in the order of the clock (only in bounded mode). Erased
+    /// variables are removed lazily, when the hand passes them or when
+    /// they make up half of the ring (see \ref compact_ring).
+    std::vector<size_t> ring;
+    size_t hand{0};
+    /// erased addresses which are still in the ring
+    phmap::flat_hash_set<size_t> ring_dead;
+    /// evicted states, which are reused when the quarantine is full
+    std::deque<VarState*> quarantine;
+    /// lossy set of recently evicted addresses
+    std::vector<size_t> evicted_filter;
+    EvictionStats stats;
+
+    ~Shard() {
+      for (auto& var : vars) {
+        var.second.var->~VarState();
+      }
+      for (VarState* var : quarantine) {
+        var->~VarState();
+      }
+    }
+  };
+
+  /// read-shared clocks of the states, outlives the shards
+  ReadSharedTable _shared;
+  std::unique_ptr<Shard[]> _shards;
+  unsigned _shift;
+  unsigned _num_shards;
+  /// maximum number of variables per shard, 0 if unbounded
+  size_t _shard_limit{0};
+  /// number of variables evicted at once, if the shard is full
+  size_t _evict_batch{0};
+  /// evicted states per shard which are not reused yet, at least one batch
+  /// such that no state of the current batch is reused
+  size_t _quarantine_limit{quarantine_size};
+
+  /// fibonacci hashing of the page to spread neighbouring pages
+  inline Shard& get_shard(size_t addr) const {
+    const uint64_t hash =
+        static_cast<uint64_t>(addr >> page_bits) * 0x9E3779B97F4A7C15ull;
+    return _shards[_num_shards == 1 ? 0 : (hash >> _shift)];
+  }
+
+  /// bit of addr in the mask of its granule
+  static inline uint64_t granule_bit(size_t addr) {
+    return uint64_t(1) << (addr & (granule_size - 1));
+  }
+
+  /// bit of the granule in the mask of its page
+  static inline uint64_t page_bit(size_t granule) {
+    return uint64_t(1) << (granule & 63);
+  }
+
+  /// bits [lo, hi) with hi <= 64
+  static inline uint64_t range_mask(size_t lo, size_t hi) {
+    const uint64_t upper = (hi >= 64) ? ~uint64_t(0) : (uint64_t(1) << hi) - 1;
+    return upper & (~uint64_t(0) << lo);
+  }
+
+  static inline unsigned lowest_bit(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward64(&idx, v);
+    return static_cast<unsigned>(idx);
+#else
+    return static_cast<unsigned>(__builtin_ctzll(v));
+#endif
+  }
+
+  /// removes the variables of the granule selected by mask
+  /// \note Invariant: requires the shard lock
+  static size_t erase_granule(Shard& shard, size_t granule, uint64_t mask) {
+    auto it = shard.granules.find(granule);
+    if (it == shard.granules.end()) return 0;
+    uint64_t hit = it->second & mask;
+    size_t num = 0;
+    while (hit != 0) {
+      const unsigned bit = lowest_bit(hit);
+      hit &= hit - 1;
+      const size_t addr = (granule << granule_bits) + bit;
+      auto var = shard.vars.find(addr);
+      if (var != shard.vars.end()) {
+        shard.pool.destroy(var->second.var);
+        shard.vars.erase(var);
+        // in bounded mode, each variable has an entry in the ring
+        if (!shard.ring.empty()) {
+          shard.ring_dead.insert(addr);
+        }
+        ++num;
+      }
+    }
+    untrack(shard, it, mask);
+    if (shard.ring_dead.size() > min_ring_dead &&
+        shard.ring_dead.size() > shard.vars.size()) {
+      compact_ring(shard);
+    }
+    return num;
+  }
+
+  /// removes the entries of erased variables from the ring
+  /// \note Invariant: requires the shard lock
+  static void compact_ring(Shard& shard) {
+    size_t kept = 0;
+    for (size_t i = 0; i < shard.ring.size(); ++i) {
+      if (i == shard.hand) {
+        shard.hand = kept;
+      }
+      if (shard.ring_dead.count(shard.ring[i]) == 0) {
+        shard.ring[kept++] = shard.ring[i];
+      }
+    }
+    shard.ring.resize(kept);
+    shard.ring_dead.clear();
+  }
+
+  /// clears the bits of mask in the granule
+  /// \note Invariant: requires the shard lock
+  static void untrack(Shard& shard,
+                      phmap::flat_hash_map<size_t, uint64_t>::iterator it,
+                      uint64_t mask) {
+    it->second &= ~mask;
+    if (it->second == 0) {
+      const size_t granule = it->first;
+      shard.granules.erase(it);
+      auto page = shard.pages.find(granule >> (page_bits - granule_bits));
+      page->second &= ~page_bit(granule);
+      if (page->second == 0) {
+        shard.pages.erase(page);
+      }
+    }
+  }
+
+  static inline size_t evicted_slot(size_t addr) {
+    return static_cast<size_t>((static_cast<uint64_t>(addr) *
+                                0x9E3779B97F4A7C15ull) >>
+                               56) %
+           evicted_filter_size;
+  }
+
+  /**
+   * \brief evict up to num cold variables of the shard
+   * \return number of evicted variables
+   * \note Invariant: requires the shard lock
+   */
+  size_t evict(Shard& shard, size_t num) {
+    size_t evicted = 0;
+    // each variable is passed at most twice (clearing its reference bit)
+    size_t steps = 2 * shard.ring.size();
+    while (evicted < num && !shard.ring.empty() && steps-- > 0) {
+      if (shard.hand >= shard.ring.size()) {
+        shard.hand = 0;
+      }
+      const size_t addr = shard.ring[shard.hand];
+      auto it = shard.vars.find(addr);
+      if (it != shard.vars.end()) {
+        if (it->second.referenced) {
+          it->second.referenced = false;
+          ++shard.hand;
+          continue;
+        }
+        VarState* var = it->second.var;
+        if (!var->try_lock()) {
+          ++shard.hand;  // currently accessed, hence not cold
+          continue;
+        }
+        var->unlock();
+        shard.vars.erase(it);
+        untrack(shard, shard.granules.find(addr >> granule_bits),
+                granule_bit(addr));
+        // late users see an empty state
+        var->~VarState();
+        new (var) VarState();
+        shard.quarantine.push_back(var);
+        if (shard.quarantine.size() > _quarantine_limit) {
+          shard.pool.destroy(shard.quarantine.front());
+          shard.quarantine.pop_front();
+        }
+        shard.evicted_filter[evicted_slot(addr)] = addr;
+        ++shard.stats.evicted;
+        ++evicted;
+      } else {
+        shard.ring_dead.erase(addr);
+      }
+      // erased or evicted, remove from the ring
+      shard.ring[shard.hand] = shard.ring.back();
+      shard.ring.pop_back();
+    }
+    return evicted;
+  }
+
+ public:
+  explicit VarTable(unsigned num_shards = default_shards) {
+    resize(num_shards);
+  }
+
+  /**
+   * \brief set the number of shards (rounded up to a power of two)
+   * \warning drops all variables and the limit (see \ref set_max_vars),
+   *          not threadsafe
+   */
+  void resize(unsigned num_shards) {
+    unsigned bits = 0;
+    while ((1u << bits) < num_shards && (1u << bits) < max_shards) {
+      ++bits;
+    }
+    _num_shards = 1u << bits;
+    _shift = 64 - bits;
+    _shards = std::make_unique<Shard[]>(_num_shards);
+    _shard_limit = 0;
+    _evict_batch = 0;
+    _quarantine_limit = quarantine_size;
+  }
+
+  /**
+   * \brief bound the number of variables, cold variables are evicted
+   * \param max_vars maximum number of variables, 0 if unbounded
+   * \warning not threadsafe, must be set before the first variable is
+   *          created
+   */
+  void set_max_vars(size_t max_vars) {
+    _shard_limit = (max_vars == 0) ? 0 : (max_vars + _num_shards - 1) /
+                                             _num_shards;
+    // evict in batches, as each eviction invalidates the access caches
+    _evict_batch = (_shard_limit + 15) / 16;
+    _quarantine_limit = std::max(quarantine_size, _evict_batch);
+    for (unsigned i = 0; i < _num_shards; ++i) {
+      _shards[i].evicted_filter.assign(
+          _shard_limit == 0 ? 0 : evicted_filter_size, 0);
+    }
+  }
+
+  /**
+   * \brief returns the state of the variable at addr, creates it if new
+   * \param evicted is set to true if variables have been evicted, hence
+   *        pointers to their states must not be used anymore
+   */
+  inline VarState* get_or_create(size_t addr, bool* evicted = nullptr) {
+    Shard& shard = get_shard(addr);
+    std::lock_guard<ipc::spinlock> lg(shard.lock);
+    auto it = shard.vars.find(addr);
+    if (it != shard.vars.end()) {
+      it->second.referenced = true;
+      return it->second.var;
+    }
+    if (_shard_limit != 0) {
+      if (shard.vars.size() >= _shard_limit) {
+        if (evict(shard, _evict_batch) != 0 && evicted != nullptr) {
+          *evicted = true;
+        }
+      }
+      if (shard.evicted_filter[evicted_slot(addr)] == addr) {
+        ++shard.stats.lost_history;
+      }
+      // the entry of an erased variable is reused
+      if (shard.ring_dead.erase(addr) == 0) {
+        shard.ring.push_back(addr);
+      }
+    }
+    ++shard.stats.created;
+    VarState* var = shard.pool.create<VarState>();
+    try {
+      shard.vars.emplace(addr, Slot{var, false});
+    } catch (...) {
+      shard.pool.destroy(var);
+      throw;
+    }
+    const size_t granule = addr >> granule_bits;
+    uint64_t& mask = shard.granules[granule];
+    if (mask == 0) {
+      shard.pages[addr >> page_bits] |= page_bit(granule);
+    }
+    mask |= granule_bit(addr);
+    return var;
+  }
+
+  /// removes the state of the variable at addr
+  inline bool erase(size_t addr) {
+    Shard& shard = get_shard(addr);
+    std::lock_guard<ipc::spinlock> lg(shard.lock);
+    return erase_granule(shard, addr >> granule_bits, granule_bit(addr)) != 0;
+  }
+
+  /**
+   * \brief removes the states of all variables in [begin, end)
+   *
+   * Costs one lookup per page plus one per populated granule and tracked
+   * variable.
+   * \return number of removed variables
+   */
+  size_t erase_range(size_t begin, size_t end) {
+    if (begin >= end) return 0;
+    const size_t first = begin >> granule_bits;
+    const size_t last = (end - 1) >> granule_bits;
+    size_t num = 0;
+    for (size_t page = begin >> page_bits; page <= (end - 1) >> page_bits;
+         ++page) {
+      const size_t page_first = page << (page_bits - granule_bits);
+      const size_t lo = (first > page_first) ? first - page_first : 0;
+      const size_t hi = (last - page_first < 64) ? last - page_first + 1 : 64;
+
+      Shard& shard = get_shard(page << page_bits);
+      std::lock_guard<ipc::spinlock> lg(shard.lock);
+      auto it = shard.pages.find(page);
+      if (it == shard.pages.end()) continue;
+      uint64_t populated = it->second & range_mask(lo, hi);
+      while (populated != 0) {
+        const size_t granule = page_first + lowest_bit(populated);
+        populated &= populated - 1;
+        // only the first and the last granule are partially covered
+        const size_t base = granule << granule_bits;
+        const size_t from = (begin > base) ? begin - base : 0;
+        const size_t to = (end - base < granule_size) ? end - base : 64;
+        num += erase_granule(shard, granule, range_mask(from, to));
+      }
+    }
+    return num;
+  }
+
+  /**
+   * \brief drop all variables
+   *
+   * The arenas of the pools and the read-shared clocks are released at
+   * once, the states are not destructed.
+   * \warning states outside of this table which use \ref shared_table
+   *          must be dropped before
+   */
+  void clear() {
+    for (unsigned i = 0; i < _num_shards; ++i) {
+      std::lock_guard<ipc::spinlock> lg(_shards[i].lock);
+      _shards[i].vars.clear();
+      _shards[i].granules.clear();
+      _shards[i].pages.clear();
+      _shards[i].ring.clear();
+      _shards[i].ring_dead.clear();
+      _shards[i].hand = 0;
+      _shards[i].quarantine.clear();
+      _shards[i].pool.release();
+    }
+    _shared.clear();
+  }
+
+  /// table of the read-shared clocks, see \ref VarState::set_read_shared
+  ReadSharedTable& shared_table() { return _shared; }
+
+  /// number of tracked variables
+  size_t size() const {
+    size_t num = 0;
+    for (unsigned i = 0; i < _num_shards; ++i) {
+      std::lock_guard<ipc::spinlock> lg(_shards[i].lock);
+      num += _shards[i].vars.size();
+    }
+    return num;
+  }
+
+  unsigned num_shards() const { return _num_shards; }
+
+  /// number of entries in the clock rings, including erased variables
+  size_t ring_size() const {
+    size_t num = 0;
+    for (unsigned i = 0; i < _num_shards; ++i) {
+      std::lock_guard<ipc::spinlock> lg(_shards[i].lock);
+      num += _shards[i].ring.size();
+    }
+    return num;
+  }
+
+  /// counters of the created and evicted variables (not reset by clear)
+  EvictionStats eviction_stats() const {
+    EvictionStats total;
+    for (unsigned i = 0; i < _num_shards; ++i) {
+      std::lock_guard<ipc::spinlock> lg(_shards[i].lock);
+      total.created += _shards[i].stats.created;
+      total.evicted += _shards[i].stats.evicted;
+      total.lost_history += _shards[i].stats.lost_history;
+    }
+    return total;
+  }
+};
+
+#endif  // !VARTABLE_H
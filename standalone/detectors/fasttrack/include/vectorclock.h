@@ -11,11 +11,16 @@
  * SPDX-License-Identifier: MIT
  */
 
-#include "parallel_hashmap/phmap.h"
+#include <algorithm>
+#include <memory>
+#include "vectorops.h"
+#include "xvector.h"
 
 /**
     Implements a VectorClock.
-    Can hold arbitrarily much pairs of a Thread Id and the belonging clock
+    The clocks are stored densely, indexed by the thread id. Thread ids are
+    compact slot numbers assigned by the detector, hence the length of a
+    clock is bounded by the largest slot in use.
 */
 template <class _al = std::allocator<std::pair<const size_t, size_t>>>
 class VectorClock {
@@ -36,79 +41,74 @@ class VectorClock {
   typedef unsigned int Clock;
 #endif
 
-  /// vector clock which contains multiple thread ids, clocks
-  phmap::flat_hash_map<uint32_t, size_t> vc;
+  using allocator_type =
+      typename std::allocator_traits<_al>::template rebind_alloc<Clock>;
+
+  /// vector clock which contains the clock of each thread, indexed by tid
+  xvector<Clock, allocator_type> vc;
 
   /// return the thread id of the position pos of the vector clock
   TID get_thr(uint32_t pos) const {
-    if (pos < vc.size()) {
-      auto it = vc.begin();
-      std::advance(it, pos);
-      return it->first;
+    if (pos < vc.size() && vc[pos] != 0) {
+      return static_cast<TID>(pos);
     } else {
       return 0;
     }
   };
 
   /// returns the no. of elements of the vector clock
-  constexpr uint32_t get_length() { return vc.size(); };
+  uint32_t get_length() const { return static_cast<uint32_t>(vc.size()); };
 
   /// updates this.vc with values of other.vc, if they're larger -> one way
   /// update
-  void update(VectorClock* other) {
-    for (auto it = other->vc.begin(); it != other->vc.end(); it++) {
-      if (it->second > get_id_by_tid(it->first)) {
-        update(it->first, it->second);
-      }
-    }
-  };
+  void update(VectorClock* other) { update(*other); };
 
   /// updates this.vc with values of other.vc, if they're larger -> one way
   /// update
   void update(const VectorClock& other) {
-    for (auto it = other.vc.begin(); it != other.vc.end(); it++) {
-      if (it->second > get_id_by_tid(it->first)) {
-        update(it->first, it->second);
-      }
+    if (vc.size() < other.vc.size()) {
+      vc.resize(other.vc.size(), 0);
     }
+    vectorops::max_merge(vc.data(), other.vc.data(), other.vc.size());
   };
 
   /// updates vector clock entry or creates entry if non-existant
   void update(TID tid, VC_ID id) {
-    auto it = vc.find(tid);
-    if (it == vc.end()) {
-      vc.insert({tid, id});
-    } else {
-      if (it->second < id) {
-        it->second = id;
-      }
+    if (vc.size() <= tid) {
+      vc.resize(static_cast<size_t>(tid) + 1, 0);
+    }
+    const Clock clk = make_clock(id);
+    if (vc[tid] < clk) {
+      vc[tid] = clk;
     }
   };
 
+  /// returns true if this clock happened before or is equal to other
+  bool leq(const VectorClock& other) const {
+    const size_t common = std::min(vc.size(), other.vc.size());
+    return vectorops::all_leq(vc.data(), other.vc.data(), common) &&
+           vectorops::all_zero(vc.data() + common, vc.size() - common);
+  }
+
   /// deletes a vector clock entry, checks existance before
-  void delete_vc(TID tid) { vc.erase(tid); }
+  void delete_vc(TID tid) {
+    if (tid < vc.size()) {
+      vc[tid] = 0;
+    }
+  }
 
   /**
    * \brief returns known clock of tid
    *        returns 0 if vc does not hold the tid
    */
-  Clock get_clock_by_tid(TID tid) const {
-    auto it = vc.find(tid);
-    if (it != vc.end()) {
-      return make_clock(it->second);
-    } else {
-      return 0;
-    }
+  inline Clock get_clock_by_tid(TID tid) const {
+    return (tid < vc.size()) ? vc[tid] : 0;
   }
 
   /// returns known whole id in vectorclock of tid
   VC_ID get_id_by_tid(TID tid) const {
-    auto it = vc.find(tid);
-    if (it != vc.end()) {
-      return it->second;
-    } else {
-      return 0;
-    }
+    const Clock clk = get_clock_by_tid(tid);
+    return (clk == 0) ? 0 : make_id(tid) + clk;
   }
 
   /// returns the tid of the id
@@ -0,0 +1,174 @@
+#ifndef VECTOROPS_H
+#define VECTOROPS_H
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+/**
+ * \brief Kernels operating on dense clock arrays
+ *
+ * The inline kernels use the widest instruction set that is enabled at
+ * compile time (e.g. by building with OPTIMIZE_FOR_NATIVE). The vector
+ * kernels are only available for 32-bit clocks, all other types use the
+ * scalar versions.
+ *
+ * The search kernels are selected at runtime depending on the features of
+ * the cpu (see src/vectorops.cpp).
+ */
+namespace vectorops {
+
+/// instruction sets of the runtime dispatched kernels
+enum class Isa { scalar = 0, sse42 = 1, avx2 = 2 };
+
+/// returns the widest instruction set supported by the cpu
+Isa detect_isa();
+
+/// returns the instruction set used by the dispatched kernels
+Isa active_isa();
+
+/**
+ * \brief select the instruction set of the dispatched kernels
+ * \return false if the cpu does not support it
+ * \note not threadsafe, intended for tests and benchmarks
+ */
+bool set_isa(Isa isa);
+
+/// returns the index of the first v[i] == value, n if not found
+size_t find(const uint32_t* v, size_t n, uint32_t value);
+
+/**
+ * \brief returns the index of the first entry (tids[i], clocks[i]) which is
+ *        not ordered before the clock vc, n if all are ordered
+ *
+ * An entry is not ordered if clocks[i] >= vc[tids[i]], where entries
+ * outside of vc are 0. Entries of skip_tid are ignored.
+ */
+size_t find_concurrent(const uint32_t* tids, const uint32_t* clocks, size_t n,
+                       const uint32_t* vc, size_t vc_len, uint32_t skip_tid);
+
+/// scalar version of \ref find for all types
+template <typename T>
+inline size_t find_scalar(const T* v, size_t n, T value) {
+  for (size_t i = 0; i < n; ++i) {
+    if (v[i] == value) return i;
+  }
+  return n;
+}
+
+/// scalar version of \ref find_concurrent for all types
+template <typename T, typename C, typename V>
+inline size_t find_concurrent_scalar(const T* tids, const C* clocks, size_t n,
+                                     const V* vc, size_t vc_len, T skip_tid) {
+  for (size_t i = 0; i < n; ++i) {
+    const T tid = tids[i];
+    const V known = (tid < vc_len) ? vc[tid] : 0;
+    if (tid != skip_tid && clocks[i] >= known) return i;
+  }
+  return n;
+}
+
+/// dst[i] = max(dst[i], src[i]) for all i < n
+template <typename T>
+inline void max_merge(T* dst, const T* src, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    if (src[i] > dst[i]) dst[i] = src[i];
+  }
+}
+
+/// returns true if a[i] <= b[i] for all i < n
+template <typename T>
+inline bool all_leq(const T* a, const T* b, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    if (a[i] > b[i]) return false;
+  }
+  return true;
+}
+
+/// returns true if v[i] == 0 for all i < n
+template <typename T>
+inline bool all_zero(const T* v, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    if (v[i] != 0) return false;
+  }
+  return true;
+}
+
+#if defined(__AVX2__)
+template <>
+inline void max_merge<uint32_t>(uint32_t* dst, const uint32_t* src,
+                                size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_max_epu32(d, s));
+  }
+  for (; i < n; ++i) {
+    if (src[i] > dst[i]) dst[i] = src[i];
+  }
+}
+
+template <>
+inline bool all_leq<uint32_t>(const uint32_t* a, const uint32_t* b,
+                              size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    // a <= b <=> max(a, b) == b
+    __m256i eq = _mm256_cmpeq_epi32(_mm256_max_epu32(va, vb), vb);
+    if (_mm256_movemask_epi8(eq) != -1) return false;
+  }
+  for (; i < n; ++i) {
+    if (a[i] > b[i]) return false;
+  }
+  return true;
+}
+#elif defined(__SSE4_1__)
+template <>
+inline void max_merge<uint32_t>(uint32_t* dst, const uint32_t* src,
+                                size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_max_epu32(d, s));
+  }
+  for (; i < n; ++i) {
+    if (src[i] > dst[i]) dst[i] = src[i];
+  }
+}
+
+template <>
+inline bool all_leq<uint32_t>(const uint32_t* a, const uint32_t* b,
+                              size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    __m128i eq = _mm_cmpeq_epi32(_mm_max_epu32(va, vb), vb);
+    if (_mm_movemask_epi8(eq) != 0xFFFF) return false;
+  }
+  for (; i < n; ++i) {
+    if (a[i] > b[i]) return false;
+  }
+  return true;
+}
+#endif
+
+}  // namespace vectorops
+
+#endif  // !VECTOROPS_H
@@ -2,6 +2,13 @@
 #include "fasttrack.h"
 #include "fasttrack_st_export.h"
 
+// the variants of the detector only differ in the policy
+#ifndef FASTTRACK_POLICY
+#define FASTTRACK_POLICY DefaultPolicy
+#endif
+
 extern "C" FASTTRACK_ST_EXPORT Detector* CreateDetector() {
-  return new drace::detector::Fasttrack<std::shared_mutex>();  // NOLINT
+  using drace::detector::FASTTRACK_POLICY;
+  return new drace::detector::Fasttrack<std::shared_mutex, VectorClock<>,
+                                        FASTTRACK_POLICY>();  // NOLINT
 }
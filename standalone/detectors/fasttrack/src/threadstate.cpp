@@ -10,17 +10,29 @@
  */
 #include "threadstate.h"
 
-ThreadState::ThreadState(VectorClock::TID own_tid,
-                         const std::shared_ptr<ThreadState>& parent)
-    : id(VectorClock::make_id(own_tid)) {
-  vc.insert({own_tid, id});
+namespace {
+std::atomic<uint64_t> next_uid{1};
+}  // namespace
+
+template <class ClockT>
+ThreadStateT<ClockT>::ThreadStateT(TID own_tid,
+                                   const std::shared_ptr<ThreadStateT>& parent,
+                                   size_t os_tid, Clock start_clock)
+    : id(VectorClock<>::make_id(own_tid) + start_clock),
+      os_tid(os_tid != 0 ? os_tid : own_tid),
+      uid(next_uid.fetch_add(1, std::memory_order_relaxed)) {
   if (parent != nullptr) {
     // if parent exists vector clock
-    vc = parent->vc;
+    static_cast<ClockT&>(*this) = *parent;
   }
+  this->update(own_tid, id);
 }
 
-void ThreadState::inc_vc() {
+template <class ClockT>
+void ThreadStateT<ClockT>::inc_vc() {
   id++;  // as the lower 32 bits are clock just increase it by ine
-  vc[VectorClock::make_tid(id)] = id;
+  this->update(VectorClock<>::make_tid(id), id);
 }
+
+template class ThreadStateT<VectorClock<>>;
+template class ThreadStateT<TreeClock>;
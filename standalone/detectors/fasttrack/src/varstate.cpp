@@ -11,7 +11,8 @@
 #include "varstate.h"
 
 /// evaluates for write/write races through this and and access through t
-bool VarState::is_ww_race(ThreadState* t) const {
+template <class ThreadT>
+bool VarState::is_ww_race(ThreadT* t) const {
   if (get_write_id() != VAR_NOT_INIT && t->get_tid() != get_w_tid() &&
       get_w_clock() >= t->get_clock_by_tid(get_w_tid())) {
     return true;
@@ -20,7 +21,8 @@ bool VarState::is_ww_race(ThreadState* t) const {
 }
 
 /// evaluates for write/read races through this and and access through t
-bool VarState::is_wr_race(ThreadState* t) const {
+template <class ThreadT>
+bool VarState::is_wr_race(ThreadT* t) const {
   auto var_tid = get_w_tid();
   if (get_write_id() != VAR_NOT_INIT && var_tid != t->get_tid() &&
       get_w_clock() >= t->get_clock_by_tid(var_tid)) {
@@ -31,7 +33,8 @@ bool VarState::is_wr_race(ThreadState* t) const {
 
 /// evaluates for read-exclusive/write races through this and and access through
 /// t
-bool VarState::is_rw_ex_race(ThreadState* t) const {
+template <class ThreadT>
+bool VarState::is_rw_ex_race(ThreadT* t) const {
   auto var_tid = get_r_tid();
   if (get_read_id() != VAR_NOT_INIT && t->get_tid() != var_tid &&
       get_r_clock() >= t->get_clock_by_tid(var_tid))  // read-write race
@@ -42,71 +45,80 @@ bool VarState::is_rw_ex_race(ThreadState* t) const {
 }
 
 /// evaluates for read-shared/write races through this and and access through t
-VectorClock<>::TID VarState::is_rw_sh_race(ThreadState* t) const {
-  for (unsigned int i = 0; i < shared_vc->size(); ++i) {
-    VectorClock<>::VC_ID act_id = get_sh_id(i);
-    VectorClock<>::TID act_tid = VectorClock<>::make_tid(act_id);
-
-    if (act_id != 0 && t->get_tid() != act_tid &&
-        VectorClock<>::make_clock(act_id) >= t->get_clock_by_tid(act_tid)) {
-      return act_tid;
-    }
+template <class ThreadT>
+VectorClock<>::TID VarState::is_rw_sh_race(ThreadT* t) const {
+  const auto& sh_vc = shared_vc();
+  size_t pos;
+  if constexpr (sizeof(VectorClock<>::Clock) == sizeof(uint32_t)) {
+    pos = vectorops::find_concurrent(
+        sh_vc.tids(), sh_vc.clocks(), sh_vc.size(),
+        reinterpret_cast<const uint32_t*>(t->vc.data()), t->vc.size(),
+        t->get_tid());
+  } else {
+    pos = vectorops::find_concurrent_scalar(
+        sh_vc.tids(), sh_vc.clocks(), sh_vc.size(), t->vc.data(),
+        t->vc.size(), static_cast<uint32_t>(t->get_tid()));
   }
-  return 0;
+  return (pos < sh_vc.size()) ? sh_vc.tid_at(pos) : 0;
 }
 
-/**
- * \todo optimize using vector instructions
- */
-auto VarState::find_in_vec(VectorClock<>::TID tid) const {
-  for (auto it = shared_vc->begin(); it != shared_vc->end(); ++it) {
-    if (VectorClock<>::make_tid(*it) == tid) {
-      return it;
-    }
-  }
-  return shared_vc->end();
-}
+// race checks for all supported clock types
+template bool VarState::is_ww_race(ThreadStateT<VectorClock<>>* t) const;
+template bool VarState::is_wr_race(ThreadStateT<VectorClock<>>* t) const;
+template bool VarState::is_rw_ex_race(ThreadStateT<VectorClock<>>* t) const;
+template VectorClock<>::TID VarState::is_rw_sh_race(
+    ThreadStateT<VectorClock<>>* t) const;
+template bool VarState::is_ww_race(ThreadStateT<TreeClock>* t) const;
+template bool VarState::is_wr_race(ThreadStateT<TreeClock>* t) const;
+template bool VarState::is_rw_ex_race(ThreadStateT<TreeClock>* t) const;
+template VectorClock<>::TID VarState::is_rw_sh_race(
+    ThreadStateT<TreeClock>* t) const;
+
 
 /**
  * \brief updates the var state because of an new read or write access through
  * an thread \todo check thread-safety
  */
-void VarState::update(bool is_write, VectorClock<>::VC_ID id) {
+void VarState::update(bool is_write, VectorClock<>::VC_ID id, uint32_t hist) {
   if (is_write) {
-    shared_vc.reset();
+    release_shared();
     r_id.store(VAR_NOT_INIT, std::memory_order_release);
-    w_id.store(id, std::memory_order_release);
+    r_hist = 0;
+    w_hist = hist;
+    // keep the lock bit as it is
+    w_id.store((w_id.load(std::memory_order_relaxed) & LOCK_BIT) | id,
+               std::memory_order_release);
 
     return;
   }
 
-  if (shared_vc == nullptr) {
+  if (!is_read_shared()) {
     r_id.store(id, std::memory_order_release);
+    r_hist = hist;
     return;
   }
 
-  auto it = find_in_vec(VectorClock<>::make_tid(id));
-  if (it != shared_vc->end()) {
-    shared_vc->erase(it);
-  }
-  shared_vc->push_back(id);
+  shared_vc().set(id, hist);
 }
 
 /// sets read state to shared
-void VarState::set_read_shared(VectorClock<>::VC_ID id) {
-  shared_vc = std::make_unique<xvector<size_t>>();
-  shared_vc->reserve(2);
-  shared_vc->push_back(r_id);
-  shared_vc->push_back(id);
+void VarState::set_read_shared(ReadSharedTable& table,
+                               VectorClock<>::VC_ID id, uint32_t hist) {
+  ReadSharedTable::Entry* sh_vc = table.allocate();
+  sh_vc->set(r_id.load(std::memory_order_relaxed), r_hist);
+  sh_vc->set(id, hist);
+  r_hist = 0;
 
-  r_id = VAR_NOT_INIT;
+  r_id.store(SHARED_BIT | (reinterpret_cast<uintptr_t>(sh_vc) >> 1),
+             std::memory_order_release);
 }
 
 /// if in read_shared state, then returns thread id of position pos in vector
 /// clock
 VectorClock<>::VC_ID VarState::get_sh_id(uint32_t pos) const {
-  if (pos < shared_vc->size()) {
-    return (*shared_vc)[pos];
+  const auto& sh_vc = shared_vc();
+  if (pos < sh_vc.size()) {
+    return sh_vc.id_at(pos);
   }
   return 0;
 }
@@ -114,17 +126,28 @@ VectorClock<>::VC_ID VarState::get_sh_id(uint32_t pos) const {
 /// return stored clock value, which belongs to ThreadState t, 0 if not
 /// available
 VectorClock<>::VC_ID VarState::get_vc_by_thr(VectorClock<>::TID tid) const {
-  auto it = find_in_vec(tid);
-  if (it != shared_vc->end()) {
-    return *it;
+  const auto& sh_vc = shared_vc();
+  const size_t pos = sh_vc.find(tid);
+  if (pos != sh_vc.size()) {
+    return sh_vc.id_at(pos);
   }
   return 0;
 }
 
 VectorClock<>::Clock VarState::get_clock_by_thr(VectorClock<>::TID tid) const {
-  auto it = find_in_vec(tid);
-  if (it != shared_vc->end()) {
-    return VectorClock<>::make_clock(*it);
+  const auto& sh_vc = shared_vc();
+  const size_t pos = sh_vc.find(tid);
+  if (pos != sh_vc.size()) {
+    return sh_vc.clock_at(pos);
+  }
+  return 0;
+}
+
+uint32_t VarState::get_hist_by_thr(VectorClock<>::TID tid) const {
+  const auto& sh_vc = shared_vc();
+  const size_t pos = sh_vc.find(tid);
+  if (pos != sh_vc.size()) {
+    return sh_vc.hist_at(pos);
   }
   return 0;
 }
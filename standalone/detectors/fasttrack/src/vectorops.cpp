@@ -0,0 +1,211 @@
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#include "vectorops.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define FT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// the vector kernels are compiled for their instruction set independent of
+// the global compiler flags, MSVC does not require this
+#if defined(__GNUC__) || defined(__clang__)
+#define FT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FT_TARGET(isa)
+#endif
+
+namespace vectorops {
+namespace {
+
+struct Kernels {
+  size_t (*find)(const uint32_t*, size_t, uint32_t);
+  size_t (*find_concurrent)(const uint32_t*, const uint32_t*, size_t,
+                            const uint32_t*, size_t, uint32_t);
+};
+
+size_t find_generic(const uint32_t* v, size_t n, uint32_t value) {
+  return find_scalar(v, n, value);
+}
+
+size_t find_concurrent_generic(const uint32_t* tids, const uint32_t* clocks,
+                               size_t n, const uint32_t* vc, size_t vc_len,
+                               uint32_t skip_tid) {
+  return find_concurrent_scalar(tids, clocks, n, vc, vc_len, skip_tid);
+}
+
+const Kernels scalar_kernels{find_generic, find_concurrent_generic};
+
+#ifdef FT_X86
+inline unsigned first_bit(unsigned mask) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return static_cast<unsigned>(idx);
+#else
+  return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+FT_TARGET("sse4.2")
+size_t find_sse42(const uint32_t* v, size_t n, uint32_t value) {
+  const __m128i needle = _mm_set1_epi32(static_cast<int>(value));
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i));
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, needle)));
+    if (mask != 0) return i + first_bit(static_cast<unsigned>(mask));
+  }
+  return i + find_scalar(v + i, n - i, value);
+}
+
+FT_TARGET("sse4.2")
+size_t find_concurrent_sse42(const uint32_t* tids, const uint32_t* clocks,
+                             size_t n, const uint32_t* vc, size_t vc_len,
+                             uint32_t skip_tid) {
+  const __m128i skip = _mm_set1_epi32(static_cast<int>(skip_tid));
+  auto known = [=](uint32_t tid) {
+    return static_cast<int>((tid < vc_len) ? vc[tid] : 0);
+  };
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    // no gather instruction, hence load the known clocks one by one
+    __m128i kn = _mm_setr_epi32(known(tids[i]), known(tids[i + 1]),
+                                known(tids[i + 2]), known(tids[i + 3]));
+    __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tids + i));
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(clocks + i));
+    // c >= kn <=> max(c, kn) == c
+    __m128i ge = _mm_cmpeq_epi32(_mm_max_epu32(c, kn), c);
+    __m128i self = _mm_cmpeq_epi32(t, skip);
+    int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(self, ge)));
+    if (mask != 0) return i + first_bit(static_cast<unsigned>(mask));
+  }
+  return i + find_concurrent_scalar(tids + i, clocks + i, n - i, vc, vc_len,
+                                    skip_tid);
+}
+
+FT_TARGET("avx2")
+size_t find_avx2(const uint32_t* v, size_t n, uint32_t value) {
+  const __m256i needle = _mm256_set1_epi32(static_cast<int>(value));
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+    int mask =
+        _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x, needle)));
+    if (mask != 0) return i + first_bit(static_cast<unsigned>(mask));
+  }
+  return i + find_scalar(v + i, n - i, value);
+}
+
+FT_TARGET("avx2")
+size_t find_concurrent_avx2(const uint32_t* tids, const uint32_t* clocks,
+                            size_t n, const uint32_t* vc, size_t vc_len,
+                            uint32_t skip_tid) {
+  if (vc_len == 0 || vc_len > 0x7FFFFFFF) {
+    return find_concurrent_scalar(tids, clocks, n, vc, vc_len, skip_tid);
+  }
+  const __m256i skip = _mm256_set1_epi32(static_cast<int>(skip_tid));
+  const __m256i last = _mm256_set1_epi32(static_cast<int>(vc_len - 1));
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tids + i));
+    __m256i c =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(clocks + i));
+    // only gather entries inside of vc (t <= last)
+    __m256i inside = _mm256_cmpeq_epi32(_mm256_min_epu32(t, last), t);
+    __m256i kn = _mm256_mask_i32gather_epi32(
+        zero, reinterpret_cast<const int*>(vc), t, inside, 4);
+    __m256i ge = _mm256_cmpeq_epi32(_mm256_max_epu32(c, kn), c);
+    __m256i self = _mm256_cmpeq_epi32(t, skip);
+    int mask = _mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_andnot_si256(self, ge)));
+    if (mask != 0) return i + first_bit(static_cast<unsigned>(mask));
+  }
+  return i + find_concurrent_scalar(tids + i, clocks + i, n - i, vc, vc_len,
+                                    skip_tid);
+}
+
+const Kernels sse42_kernels{find_sse42, find_concurrent_sse42};
+const Kernels avx2_kernels{find_avx2, find_concurrent_avx2};
+
+bool cpu_supports(Isa isa) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  const int max_leaf = info[0];
+  __cpuid(info, 1);
+  const bool sse42 = (info[2] & (1 << 20)) != 0;
+  if (isa == Isa::sse42) return sse42;
+  // AVX2 also requires the OS to save the ymm registers
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (max_leaf < 7 || !osxsave || (_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  if (isa == Isa::sse42) return __builtin_cpu_supports("sse4.2");
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif  // FT_X86
+
+const Kernels* kernels = &scalar_kernels;
+Isa current = Isa::scalar;
+
+// select the best kernels when the library is loaded
+[[maybe_unused]] const bool initialized = set_isa(detect_isa());
+
+}  // namespace
+
+Isa detect_isa() {
+#ifdef FT_X86
+  if (cpu_supports(Isa::avx2)) return Isa::avx2;
+  if (cpu_supports(Isa::sse42)) return Isa::sse42;
+#endif
+  return Isa::scalar;
+}
+
+Isa active_isa() { return current; }
+
+bool set_isa(Isa isa) {
+  switch (isa) {
+#ifdef FT_X86
+    case Isa::avx2:
+      if (!cpu_supports(isa)) return false;
+      kernels = &avx2_kernels;
+      break;
+    case Isa::sse42:
+      if (!cpu_supports(isa)) return false;
+      kernels = &sse42_kernels;
+      break;
+#endif
+    case Isa::scalar:
+      kernels = &scalar_kernels;
+      break;
+    default:
+      return false;
+  }
+  current = isa;
+  return true;
+}
+
+size_t find(const uint32_t* v, size_t n, uint32_t value) {
+  return kernels->find(v, n, value);
+}
+
+size_t find_concurrent(const uint32_t* tids, const uint32_t* clocks, size_t n,
+                       const uint32_t* vc, size_t vc_len, uint32_t skip_tid) {
+  return kernels->find_concurrent(tids, clocks, n, vc, vc_len, skip_tid);
+}
+
+}  // namespace vectorops
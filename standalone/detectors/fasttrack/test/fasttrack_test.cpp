@@ -10,7 +10,10 @@
  */
 
 #include <fasttrack.h>
+#include <atomic>
 #include <random>
+#include <set>
+#include <thread>
 #include "gtest/gtest.h"
 
 //#include "stacktrace.h"
@@ -21,24 +24,24 @@ TEST(FasttrackTest, basic_stacktrace) {
   StackTrace st;
 
   st.push_stack_element(1);
-  st.set_read_write(100, 1000);
-  st.set_read_write(101, 1001);
+  st.record_access(1000);
+  st.record_access(1001);
 
   st.push_stack_element(2);
-  st.set_read_write(102, 1002);
+  st.record_access(1002);
 
   st.push_stack_element(3);
-  st.set_read_write(103, 1004);
+  st.record_access(1004);
 
   st.pop_stack_element();
 
   st.push_stack_element(1);
   st.push_stack_element(2);
   st.push_stack_element(6);
-  st.set_read_write(104, 1004);
+  auto hist = st.record_access(1004);
   st.push_stack_element(7);
 
-  std::list<size_t> list = st.return_stack_trace(104);
+  std::list<size_t> list = st.return_stack_trace(hist);
   std::vector<size_t> vec(list.begin(), list.end());
 
   ASSERT_EQ(vec[0], 1);
@@ -53,8 +56,9 @@ TEST(FasttrackTest, basic_stacktrace) {
 TEST(FasttrackTest, ItemNotFoundInTrace) {
   StackTrace st;
   st.push_stack_element(42);
-  // lookup element 40, which is not in the trace
-  auto list = st.return_stack_trace(40);
+  // lookup an id which has not been issued by the depot
+  auto list = st.return_stack_trace(
+      static_cast<StackTrace::HistoryId>(StackDepot::instance().size() + 40));
   ASSERT_EQ(list.size(), 0);
 }
 
@@ -67,14 +71,14 @@ TEST(FasttrackTest, stackAllocations) {
   for (int i = 0; i < 1000; ++i) {
     for (int j = 0; j < 7; ++j) {
       st.push_stack_element(j + i);
-      st.set_read_write(j, j * 100);
+      st.record_access(j * 100);
     }
     for (int k = 0; k < 5; ++k) {
       st.pop_stack_element();
     }
     for (int l = 7; l < 10; ++l) {
       st.push_stack_element(l + i);
-      st.set_read_write(l, l * 100);
+      st.record_access(l * 100);
     }
     for (int m = 0; m < 5; m++) {
       st.pop_stack_element();
@@ -84,6 +88,57 @@ TEST(FasttrackTest, stackAllocations) {
   }
 }
 
+TEST(FasttrackTest, stackDepotSharing) {
+  StackTrace st1;
+  StackTrace st2;
+  for (size_t i = 1; i <= 20; ++i) {
+    st1.push_stack_element(i);
+    st2.push_stack_element(i);
+  }
+  // the same call path is interned once, independent of the thread
+  const size_t num_stacks = StackDepot::instance().size();
+  const auto hist = st1.record_access(100);
+  EXPECT_EQ(st2.record_access(100), hist);
+  EXPECT_LE(StackDepot::instance().size(), num_stacks + 1);
+  st2.pop_stack_element();
+  EXPECT_NE(st2.record_access(100), hist);
+
+  // only the innermost frames are kept
+  std::array<uintptr_t, 4> frames;
+  ASSERT_EQ(StackDepot::instance().depth(hist), 21u);
+  ASSERT_EQ(StackDepot::instance().get_frames(hist, frames.data(), 4), 4u);
+  EXPECT_EQ(frames, (std::array<uintptr_t, 4>{18, 19, 20, 100}));
+}
+
+TEST(FasttrackTest, stackDepotFull) {
+  StackDepot depot;
+  depot.set_max_nodes(3);
+  for (StackDepot::StackId i = 1; i <= 3; ++i) {
+    EXPECT_EQ(depot.intern(0, 0x100 + i), i);
+  }
+  // new stacks are not stored, known stacks are still found
+  EXPECT_EQ(depot.intern(0, 0x200), 0);
+  EXPECT_EQ(depot.intern(2, 0x100), 0);
+  EXPECT_EQ(depot.intern(0, 0x102), 2);
+  EXPECT_EQ(depot.size(), 3);
+  EXPECT_EQ(depot.dropped(), 2);
+
+  // frames which are not stored are tracked, but have no history
+  StackTrace st;
+  st.push_stack_element(0x1234);
+  const auto hist = st.record_access(0x5678);
+  ASSERT_NE(hist, 0);
+  StackDepot& global = StackDepot::instance();
+  global.set_max_nodes(global.size());
+  st.push_stack_element(0x9abc);
+  st.push_stack_element(0x1234);
+  EXPECT_EQ(st.record_access(0x5678), 0);
+  st.pop_stack_element();
+  st.pop_stack_element();
+  EXPECT_EQ(st.record_access(0x5678), hist);
+  global.set_max_nodes(StackDepot::default_max_nodes);
+}
+
 TEST(FasttrackTest, stackInitializations) {
   std::vector<std::shared_ptr<StackTrace>> vec;
   std::list<size_t> stack;
@@ -96,8 +151,8 @@ TEST(FasttrackTest, stackInitializations) {
     cp->push_stack_element(1);
     cp->push_stack_element(2);
     cp->push_stack_element(3);
-    cp->set_read_write(5, 4);
-    stack = cp->return_stack_trace(5);
+    auto hist = cp->record_access(4);
+    stack = cp->return_stack_trace(hist);
   }
   vec[78]->pop_stack_element();
   ASSERT_EQ(stack.size(), 4);  // TODO: validate
@@ -112,7 +167,7 @@ TEST(FasttrackTest, IndicateRaces1) {
   auto t1 = std::make_shared<ThreadState>(1);
   auto t2 = std::make_shared<ThreadState>(2);
 
-  auto v1 = std::make_shared<VarState>(1);
+  auto v1 = std::make_shared<VarState>();
 
   // t1 writes to v1
   v1->update(true, t1->return_own_id());
@@ -126,7 +181,7 @@ TEST(FasttrackTest, IndicateRaces2) {
   auto t1 = std::make_shared<ThreadState>(1);
   auto t2 = std::make_shared<ThreadState>(2);
 
-  auto v1 = std::make_shared<VarState>(1);
+  auto v1 = std::make_shared<VarState>();
 
   // t1 reads v1
   v1->update(false, t1->return_own_id());
@@ -141,11 +196,12 @@ TEST(FasttrackTest, IndicateRaces3) {
   auto t2 = std::make_shared<ThreadState>(2);
   auto t3 = std::make_shared<ThreadState>(3);
 
-  auto v1 = std::make_shared<VarState>(1);
+  ReadSharedTable shared;
+  auto v1 = std::make_shared<VarState>();
 
   // t1 and t2 read v1
   v1->update(false, t1->return_own_id());
-  v1->set_read_shared(t2->return_own_id());
+  v1->set_read_shared(shared, t2->return_own_id());
 
   ASSERT_FALSE(v1->is_wr_race(t3.get()));
   ASSERT_FALSE(v1->is_rw_ex_race(t3.get()));
@@ -180,3 +236,1097 @@ TEST(FasttrackTest, FullFtSimpleRace) {
   // here, we expect the race. Handled in callback
   ft->finalize();
 }
+
+TEST(FasttrackTest, ShadowMemoryMapping) {
+  ShadowMemory<VarState> shadow;
+  constexpr size_t gran = ShadowMemory<VarState>::granularity;
+  const uintptr_t base = 0x10000000ull;
+
+  ASSERT_TRUE(shadow.map_region((void*)base, 0x100000));
+  // overlapping regions are rejected
+  ASSERT_FALSE(shadow.map_region((void*)(base + 0x1000), 0x1000));
+
+  EXPECT_EQ(shadow.find(base - 1), nullptr);
+  EXPECT_EQ(shadow.find(base + 0x100000), nullptr);
+  EXPECT_EQ(shadow.num_chunks(), 0);
+
+  VarState* v1 = shadow.find(base);
+  ASSERT_NE(v1, nullptr);
+  // each byte has its own cell
+  EXPECT_EQ(shadow.find(base + gran), v1 + 1);
+  EXPECT_EQ(shadow.find(base + 7 * gran), v1 + 7);
+  EXPECT_EQ(shadow.num_chunks(), 1);
+
+  v1->update(true, VectorClock<>::make_id(1) + 1);
+  EXPECT_NE(v1->get_write_id(), VarState::VAR_NOT_INIT);
+  ASSERT_TRUE(shadow.reset(base, gran));
+  EXPECT_EQ(v1->get_write_id(), VarState::VAR_NOT_INIT);
+}
+
+TEST(FasttrackTest, FullFtShadowRace) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex>>();
+  static unsigned num_races;
+  num_races = 0;
+  auto rc_clb = [](const Detector::Race* r, void*) { ++num_races; };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[2];
+
+  ft->init(1, argv_mock, rc_clb, nullptr);
+  ft->map_shadow((void*)0x20000000ull, 0x10000);
+
+  ft->fork(0, 1, &tls[0]);
+  ft->fork(0, 2, &tls[1]);
+
+  ft->acquire(tls[0], (void*)0x99ull, 1, true);
+  ft->write(tls[0], (void*)0x1ull, (void*)0x20000020ull, 8);
+  ft->release(tls[0], (void*)0x99ull, true);
+  ft->write(tls[0], (void*)0x1ull, (void*)0x20000010ull, 8);
+  EXPECT_EQ(num_races, 0);
+
+  ft->acquire(tls[1], (void*)0x99ull, 1, true);
+  ft->read(tls[1], (void*)0x2ull, (void*)0x20000020ull, 8);
+  ft->release(tls[1], (void*)0x99ull, true);
+  EXPECT_EQ(num_races, 0);
+
+  ft->write(tls[1], (void*)0x3ull, (void*)0x20000010ull, 8);
+  EXPECT_EQ(num_races, 1);
+  ft->finalize();
+}
+
+TEST(FasttrackTest, FullFtShadowAdjacentBytes) {
+  using namespace drace::detector;
+
+  static unsigned num_races;
+  auto rc_clb = [](const Detector::Race* r, void*) { ++num_races; };
+  const char* argv_mock[] = {"ft_test"};
+
+  // distinct bytes of a word do not race, with and without shadow memory
+  for (bool shadowed : {false, true}) {
+    auto ft = std::make_unique<Fasttrack<std::mutex>>();
+    num_races = 0;
+    void* tls[2];
+    ft->init(1, argv_mock, rc_clb, nullptr);
+    if (shadowed) {
+      ft->map_shadow((void*)0x20000000ull, 0x10000);
+    }
+    ft->fork(0, 1, &tls[0]);
+    ft->fork(0, 2, &tls[1]);
+
+    ft->write(tls[0], (void*)0x1ull, (void*)0x20000000ull, 1);
+    ft->write(tls[1], (void*)0x2ull, (void*)0x20000001ull, 1);
+    EXPECT_EQ(num_races, 0) << "shadowed: " << shadowed;
+
+    ft->write(tls[1], (void*)0x3ull, (void*)0x20000000ull, 1);
+    EXPECT_EQ(num_races, 1) << "shadowed: " << shadowed;
+    ft->finalize();
+  }
+}
+
+TEST(FasttrackTest, ShardedVarTable) {
+  VarTable table(5);
+  // rounded up to next power of two
+  EXPECT_EQ(table.num_shards(), 8);
+
+  VarState* v1 = table.get_or_create(0x100);
+  VarState* v2 = table.get_or_create(0x108);
+  EXPECT_NE(v1, v2);
+  EXPECT_EQ(table.get_or_create(0x100), v1);
+  EXPECT_EQ(table.size(), 2);
+
+  EXPECT_TRUE(table.erase(0x100));
+  EXPECT_FALSE(table.erase(0x100));
+  EXPECT_EQ(table.size(), 1);
+
+  table.resize(1);
+  EXPECT_EQ(table.num_shards(), 1);
+  EXPECT_EQ(table.size(), 0);
+  EXPECT_NE(table.get_or_create(0x100), nullptr);
+}
+
+TEST(FasttrackTest, PoolAllocator) {
+  util::PoolAllocator<4096> pool;
+  void* a = pool.allocate(24);
+  void* b = pool.allocate(32);
+  // same size class, 16 byte aligned
+  EXPECT_EQ(static_cast<char*>(b) - static_cast<char*>(a), 32);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % 16, 0u);
+  pool.deallocate(a, 24);
+  EXPECT_EQ(pool.allocate(17), a);
+
+  for (int i = 0; i < 1000; ++i) {
+    pool.allocate(64);
+  }
+  EXPECT_GT(pool.num_arenas(), 1u);
+  void* large = pool.allocate(1024);
+  pool.deallocate(large, 1024);
+  pool.release();
+  EXPECT_EQ(pool.num_arenas(), 0u);
+}
+
+TEST(FasttrackTest, VarTableBulkClear) {
+  VarTable table(4);
+  ReadSharedTable& shared = table.shared_table();
+  for (size_t i = 0; i < 10000; ++i) {
+    VarState* v = table.get_or_create(0x1000 + i * 8);
+    v->update(false, VectorClock<>::make_id(1) + 1);
+    if (i % 100 == 0) {
+      v->set_read_shared(shared, VectorClock<>::make_id(2) + 1);
+    }
+  }
+  EXPECT_EQ(table.size(), 10000);
+  EXPECT_EQ(shared.size(), 100);
+  EXPECT_EQ(table.erase_range(0x1000, 0x1000 + 800), 100);
+  EXPECT_EQ(shared.size(), 99);
+
+  // freed states are reused
+  VarState* v = table.get_or_create(0x1000);
+  EXPECT_EQ(v->get_read_id(), VarState::VAR_NOT_INIT);
+
+  // the read-shared clocks are dropped with the table
+  table.clear();
+  EXPECT_EQ(table.size(), 0);
+  EXPECT_EQ(shared.size(), 0);
+  EXPECT_EQ(table.get_or_create(0x1000)->get_write_id(),
+            VarState::VAR_NOT_INIT);
+}
+
+TEST(FasttrackTest, VarTableEviction) {
+  VarTable table(1);
+  table.set_max_vars(64);
+  VarState* hot = table.get_or_create(0x1000);
+  bool evicted = false;
+  for (size_t i = 1; i <= 1000; ++i) {
+    table.get_or_create(0x1000 + i * 8, &evicted);
+    // keep the first variable referenced
+    EXPECT_EQ(table.get_or_create(0x1000), hot);
+  }
+  EXPECT_TRUE(evicted);
+  EXPECT_LE(table.size(), 64);
+
+  auto stats = table.eviction_stats();
+  EXPECT_EQ(stats.created, 1001);
+  EXPECT_EQ(stats.evicted, 1001 - table.size());
+  EXPECT_EQ(table.erase_range(0x1000, 0x1000 + 8), 1);
+
+  // re-created states of recently evicted variables are counted
+  VarTable small(1);
+  small.set_max_vars(16);
+  for (size_t i = 0; i <= 16; ++i) {
+    small.get_or_create(0x100 + i * 8);
+  }
+  EXPECT_EQ(small.eviction_stats().evicted, 1);
+  EXPECT_EQ(small.eviction_stats().lost_history, 0);
+  small.get_or_create(0x100);
+  EXPECT_EQ(small.eviction_stats().lost_history, 1);
+}
+
+TEST(FasttrackTest, VarTableEvictionChurn) {
+  // alloc/free churn never fills the table, the ring must not grow
+  VarTable table(1);
+  table.set_max_vars(1000);
+  for (size_t i = 0; i < 200000; ++i) {
+    const size_t addr = 0x100000 + i * 64;
+    table.get_or_create(addr);
+    table.erase_range(addr, addr + 64);
+  }
+  EXPECT_EQ(table.size(), 0);
+  EXPECT_LE(table.ring_size(), 2 * 1000);
+
+  EXPECT_EQ(table.eviction_stats().evicted, 0);
+
+  // re-created addresses do not add duplicate entries
+  VarTable small(1);
+  small.set_max_vars(1000);
+  for (size_t round = 0; round < 4; ++round) {
+    if (round > 0) {
+      small.erase_range(0x1000, 0x1000 + 80);
+    }
+    for (size_t i = 0; i < 10; ++i) {
+      small.get_or_create(0x1000 + i * 8);
+    }
+  }
+  EXPECT_EQ(small.size(), 10);
+  EXPECT_EQ(small.ring_size(), 10);
+}
+
+TEST(FasttrackTest, VarTableEvictionQuarantine) {
+  // one batch evicts more states than the minimal quarantine
+  constexpr size_t max_vars = 32 * VarTable::quarantine_size;
+  VarTable table(1);
+  table.set_max_vars(max_vars);
+  std::set<VarState*> states;
+  for (size_t i = 0; i < max_vars; ++i) {
+    states.insert(table.get_or_create(0x100000 + i * 8));
+  }
+  bool evicted = false;
+  VarState* var = table.get_or_create(0x10, &evicted);
+  EXPECT_TRUE(evicted);
+  EXPECT_GT(table.eviction_stats().evicted, VarTable::quarantine_size);
+  // states evicted by this batch might still be in use
+  EXPECT_EQ(states.count(var), 0);
+}
+
+TEST(FasttrackTest, FullFtBoundedMemory) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex>>();
+  int races = 0;
+  auto rc_clb = [](const Detector::Race* r, void* ctx) {
+    EXPECT_EQ(r->first.accessed_memory, 0x42ull);
+    ++*static_cast<int*>(ctx);
+  };
+  // 1 MiB, i.e. few thousand variables per shard
+  const char* argv_mock[] = {"ft_test", "--shards", "1", "--max-shadow-mb",
+                             "1"};
+  void* tls[2];
+
+  ft->init(5, argv_mock, rc_clb, &races);
+  ft->fork(0, 1, &tls[0]);
+  ft->fork(0, 2, &tls[1]);
+
+  ft->write(tls[0], (void*)0x1ull, (void*)0x42ull, 1);
+  // cold variables of the first thread are evicted
+  for (size_t i = 0; i < 100000; ++i) {
+    ft->write(tls[0], (void*)0x1ull, (void*)(0x10000ull + i * 8), 8);
+    ft->read(tls[0], (void*)0x1ull, (void*)0x42ull, 1);
+  }
+  ft->write(tls[1], (void*)0x2ull, (void*)0x42ull, 1);
+  EXPECT_EQ(races, 1);
+  ft->finalize();
+}
+
+TEST(FasttrackTest, CompactVarState) {
+  EXPECT_EQ(sizeof(VarState),
+            2 * sizeof(VectorClock<>::VC_ID) + 2 * sizeof(uint32_t));
+
+  ReadSharedTable shared;
+  {
+    VarState v;
+    const auto t1 = VectorClock<>::make_id(1) + 5;
+    const auto t2 = VectorClock<>::make_id(2) + 7;
+
+    // lock bit is not visible in the write epoch
+    v.lock();
+    EXPECT_FALSE(v.try_lock());
+    v.update(true, t1);
+    EXPECT_EQ(v.get_write_id(), t1);
+    EXPECT_EQ(v.get_w_tid(), 1);
+    v.unlock();
+    EXPECT_TRUE(v.try_lock());
+    v.unlock();
+    EXPECT_EQ(v.get_write_id(), t1);
+
+    v.update(false, t1);
+    v.set_read_shared(shared, t2);
+    EXPECT_TRUE(v.is_read_shared());
+    EXPECT_EQ(v.get_read_id(), VarState::VAR_NOT_INIT);
+    EXPECT_EQ(v.get_vc_by_thr(1), t1);
+    EXPECT_EQ(v.get_clock_by_thr(2), 7);
+    EXPECT_EQ(shared.size(), 1);
+
+    // write resets the read-shared state
+    v.update(true, t2);
+    EXPECT_FALSE(v.is_read_shared());
+    EXPECT_EQ(shared.size(), 0);
+
+    v.update(false, t1);
+    v.set_read_shared(shared, t2);
+  }
+  // entry is released on destruction
+  EXPECT_EQ(shared.size(), 0);
+}
+
+TEST(FasttrackTest, DenseVectorClock) {
+  using VC = VectorClock<>;
+  VC a;
+  VC b;
+  // more entries than one SIMD register holds, to cover the tail loops
+  for (VC::TID t = 1; t < 20; ++t) {
+    a.update(t, VC::make_id(t) + t);
+    b.update(t, VC::make_id(t) + 20 - t);
+  }
+  EXPECT_FALSE(a.leq(b));
+  EXPECT_FALSE(b.leq(a));
+
+  VC c;
+  c.update(a);
+  c.update(&b);
+  EXPECT_TRUE(a.leq(c));
+  EXPECT_TRUE(b.leq(c));
+  EXPECT_EQ(c.get_clock_by_tid(3), 17);
+  EXPECT_EQ(c.get_clock_by_tid(15), 15);
+  EXPECT_EQ(c.get_id_by_tid(4), VC::make_id(4) + 16);
+  EXPECT_EQ(c.get_clock_by_tid(100), 0);
+
+  // deleted entries are treated as unknown
+  c.delete_vc(3);
+  EXPECT_EQ(c.get_id_by_tid(3), 0);
+  EXPECT_FALSE(a.leq(c));
+
+  // trailing zeros do not affect the ordering
+  VC d;
+  d.update(30, VC::make_id(30) + 1);
+  d.delete_vc(30);
+  EXPECT_TRUE(d.leq(a));
+}
+
+TEST(FasttrackTest, ThreadSlots) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex>>();
+  static std::vector<unsigned> race_tids;
+  race_tids.clear();
+  auto rc_clb = [](const Detector::Race* r, void*) {
+    race_tids.push_back(r->first.thread_id);
+    race_tids.push_back(r->second.thread_id);
+  };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[2];
+
+  ft->init(1, argv_mock, rc_clb, nullptr);
+  // large OS thread ids are mapped to dense slots
+  ft->fork(0, 70000, &tls[0]);
+  ft->fork(0, 123456, &tls[1]);
+  auto t1 = reinterpret_cast<ThreadState*>(tls[0]);
+  auto t2 = reinterpret_cast<ThreadState*>(tls[1]);
+  EXPECT_EQ(t1->get_tid(), 1);
+  EXPECT_EQ(t2->get_tid(), 2);
+  EXPECT_EQ(t2->get_os_tid(), 123456);
+  EXPECT_LE(t2->get_length(), 3);
+
+  ft->write(tls[0], (void*)0x1ull, (void*)0x42ull, 1);
+  ft->write(tls[1], (void*)0x2ull, (void*)0x42ull, 1);
+  // races are reported with the OS thread ids
+  ASSERT_EQ(race_tids.size(), 2);
+  EXPECT_EQ(race_tids[0], 70000);
+  EXPECT_EQ(race_tids[1], 123456);
+  ft->finalize();
+}
+
+TEST(FasttrackTest, SlotAllocatorReuse) {
+  SlotAllocator<ThreadState> slots;
+  VectorClock<>::Clock start;
+
+  const auto s1 = slots.acquire(&start);
+  EXPECT_EQ(s1, 1);
+  EXPECT_EQ(start, 0);
+  const auto s2 = slots.acquire(&start);
+  EXPECT_EQ(s2, 2);
+  EXPECT_EQ(slots.num_used(), 2);
+
+  slots.release(s1, 41);
+  EXPECT_EQ(slots.owner(s1), nullptr);
+  // slot is reused and its clock continues
+  EXPECT_EQ(slots.acquire(&start), s1);
+  EXPECT_EQ(start, 42);
+  EXPECT_EQ(slots.start_clock(s1), 42);
+  EXPECT_EQ(slots.size(), 2);
+}
+
+TEST(FasttrackTest, FullFtSlotReuse) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex>>();
+  static std::vector<unsigned> race_tids;
+  race_tids.clear();
+  auto rc_clb = [](const Detector::Race* r, void*) {
+    race_tids.push_back(r->first.thread_id);
+    race_tids.push_back(r->second.thread_id);
+  };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[3];
+
+  ft->init(1, argv_mock, rc_clb, nullptr);
+  ft->fork(0, 1, &tls[0]);
+  ft->fork(0, 2, &tls[1]);
+
+  ft->acquire(tls[0], (void*)0x99ull, 1, true);
+  ft->write(tls[0], (void*)0x1ull, (void*)0x42ull, 8);
+  ft->release(tls[0], (void*)0x99ull, true);
+  const auto old_id = reinterpret_cast<ThreadState*>(tls[0])->return_own_id();
+  ft->finish(tls[0], 1);
+
+  // thread 3 takes over the slot of thread 1
+  ft->fork(0, 3, &tls[2]);
+  auto t3 = reinterpret_cast<ThreadState*>(tls[2]);
+  EXPECT_EQ(t3->get_tid(), VectorClock<>::make_tid(old_id));
+  EXPECT_GT(t3->return_own_id(), old_id);
+
+  // synchronized with thread 1, stale entry of the slot is fine
+  ft->acquire(tls[1], (void*)0x99ull, 1, true);
+  ft->read(tls[1], (void*)0x2ull, (void*)0x42ull, 8);
+  EXPECT_TRUE(race_tids.empty());
+
+  // but does not order the accesses of thread 3
+  ft->write(tls[2], (void*)0x3ull, (void*)0x50ull, 8);
+  ft->write(tls[1], (void*)0x4ull, (void*)0x50ull, 8);
+  ASSERT_EQ(race_tids.size(), 2);
+  EXPECT_EQ(race_tids[0], 3);
+  EXPECT_EQ(race_tids[1], 2);
+  EXPECT_LE(reinterpret_cast<ThreadState*>(tls[1])->get_length(), 3);
+  ft->finalize();
+}
+
+TEST(FasttrackTest, TreeClockMatchesVectorClock) {
+  using VTS = ThreadStateT<VectorClock<>>;
+  using TTS = ThreadStateT<TreeClock>;
+  constexpr unsigned num_threads = 12;
+  constexpr unsigned num_locks = 4;
+
+  std::vector<std::shared_ptr<VTS>> vthr;
+  std::vector<std::shared_ptr<TTS>> tthr;
+  for (unsigned t = 1; t <= num_threads; ++t) {
+    vthr.emplace_back(std::make_shared<VTS>(t));
+    tthr.emplace_back(std::make_shared<TTS>(t));
+    vthr.back()->inc_vc();
+    tthr.back()->inc_vc();
+  }
+  std::vector<VectorClock<>> vlocks(num_locks);
+  std::vector<TreeClock> tlocks(num_locks);
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<unsigned> thr_dist(0, num_threads - 1);
+  std::uniform_int_distribution<unsigned> lock_dist(0, num_locks - 1);
+  std::uniform_int_distribution<unsigned> op_dist(0, 9);
+
+  for (int i = 0; i < 5000; ++i) {
+    const unsigned t = thr_dist(gen);
+    const unsigned l = lock_dist(gen);
+    const unsigned op = op_dist(gen);
+    if (op < 4) {  // acquire
+      vthr[t]->update(vlocks[l]);
+      tthr[t]->update(tlocks[l]);
+    } else if (op < 8) {  // release
+      vthr[t]->inc_vc();
+      tthr[t]->inc_vc();
+      vlocks[l].update(vthr[t].get());
+      tlocks[l].update(tthr[t].get());
+    } else if (op < 9) {  // join another thread
+      const unsigned o = thr_dist(gen);
+      if (o == t) continue;
+      vthr[o]->inc_vc();
+      tthr[o]->inc_vc();
+      vthr[t]->update(*vthr[o]);
+      tthr[t]->update(*tthr[o]);
+    } else {  // local step
+      vthr[t]->inc_vc();
+      tthr[t]->inc_vc();
+    }
+    for (unsigned k = 0; k < num_threads; ++k) {
+      for (VectorClock<>::TID j = 1; j <= num_threads; ++j) {
+        ASSERT_EQ(vthr[k]->get_clock_by_tid(j), tthr[k]->get_clock_by_tid(j))
+            << "step " << i << " thread " << k << " entry " << j;
+      }
+    }
+    for (unsigned k = 0; k < num_locks; ++k) {
+      for (VectorClock<>::TID j = 1; j <= num_threads; ++j) {
+        ASSERT_EQ(vlocks[k].get_clock_by_tid(j), tlocks[k].get_clock_by_tid(j))
+            << "step " << i << " lock " << k << " entry " << j;
+      }
+    }
+  }
+}
+
+TEST(FasttrackTest, TreeClockHandoff) {
+  using TTS = ThreadStateT<TreeClock>;
+  auto t1 = std::make_shared<TTS>(1);
+  auto t2 = std::make_shared<TTS>(2);
+  auto t3 = std::make_shared<TTS>(3);
+  TreeClock lock;
+
+  t1->inc_vc();
+  lock.update(t1.get());
+  EXPECT_EQ(lock.get_root(), 1);
+  t2->update(lock);
+  t2->inc_vc();
+  lock.update(t2.get());
+  EXPECT_EQ(lock.get_root(), 2);
+  t3->update(lock);
+  EXPECT_EQ(t3->get_clock_by_tid(1), 1);
+  EXPECT_EQ(t3->get_clock_by_tid(2), 1);
+
+  // only the entries of the last owner changed
+  t3->inc_vc();
+  lock.update(t3.get());
+  t2->inc_vc();
+  t2->update(lock);
+  EXPECT_EQ(t2->last_updated(), 1);
+  EXPECT_EQ(t2->get_clock_by_tid(3), 1);
+}
+
+TEST(FasttrackTest, FullFtTreeClock) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex, TreeClock>>();
+  static unsigned num_races;
+  num_races = 0;
+  auto rc_clb = [](const Detector::Race* r, void*) { ++num_races; };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[3];
+
+  ft->init(1, argv_mock, rc_clb, nullptr);
+  ft->fork(0, 1, &tls[0]);
+  ft->fork(0, 2, &tls[1]);
+
+  // lock protected accesses
+  for (int i = 0; i < 3; ++i) {
+    for (int t = 0; t < 2; ++t) {
+      ft->acquire(tls[t], (void*)0x99ull, 1, true);
+      ft->write(tls[t], (void*)0x1ull, (void*)0x42ull, 8);
+      ft->release(tls[t], (void*)0x99ull, true);
+    }
+  }
+  EXPECT_EQ(num_races, 0);
+
+  // happens-before publishes the full clock of thread 1
+  ft->happens_before(tls[0], (void*)0x77ull);
+  ft->happens_after(tls[1], (void*)0x77ull);
+  ft->write(tls[1], (void*)0x3ull, (void*)0x42ull, 8);
+  EXPECT_EQ(num_races, 0);
+
+  // a reused slot inherits the clock of its previous owner
+  ft->write(tls[0], (void*)0x4ull, (void*)0x50ull, 8);
+  ft->finish(tls[0], 1);
+  ft->fork(0, 3, &tls[2]);
+  ft->write(tls[2], (void*)0x5ull, (void*)0x50ull, 8);
+  EXPECT_EQ(num_races, 0);
+
+  ft->write(tls[1], (void*)0x6ull, (void*)0x50ull, 8);
+  EXPECT_EQ(num_races, 1);
+  ft->finalize();
+}
+
+TEST(FasttrackTest, VectorOpsDispatch) {
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<uint32_t> tid_dist(1, 40);
+  std::uniform_int_distribution<uint32_t> clk_dist(0, 20);
+  const vectorops::Isa best = vectorops::detect_isa();
+
+  for (int round = 0; round < 200; ++round) {
+    const size_t n = round % 37;
+    std::vector<uint32_t> tids(n), clocks(n), vc(round % 45);
+    for (size_t i = 0; i < n; ++i) {
+      tids[i] = tid_dist(gen);
+      clocks[i] = clk_dist(gen);
+    }
+    // known clocks are mostly ahead, to find races at all positions
+    for (auto& c : vc) c = clk_dist(gen) + 15;
+    const uint32_t needle = tid_dist(gen);
+    const uint32_t skip = tid_dist(gen);
+
+    const size_t exp_find = vectorops::find_scalar(tids.data(), n, needle);
+    const size_t exp_conc = vectorops::find_concurrent_scalar(
+        tids.data(), clocks.data(), n, vc.data(), vc.size(), skip);
+    for (int isa = 0; isa <= static_cast<int>(best); ++isa) {
+      ASSERT_TRUE(vectorops::set_isa(static_cast<vectorops::Isa>(isa)));
+      EXPECT_EQ(vectorops::find(tids.data(), n, needle), exp_find);
+      EXPECT_EQ(vectorops::find_concurrent(tids.data(), clocks.data(), n,
+                                           vc.data(), vc.size(), skip),
+                exp_conc)
+          << "isa " << isa << " round " << round;
+    }
+  }
+  vectorops::set_isa(best);
+  EXPECT_EQ(vectorops::active_isa(), best);
+}
+
+TEST(FasttrackTest, ReadSharedClock) {
+  using VC = VectorClock<>;
+  ReadSharedClock sh;
+  // a few readers are stored inline, re-reads update in place
+  for (VC::TID t = 1; t <= 4; ++t) {
+    sh.set(VC::make_id(t) + t);
+    sh.set(VC::make_id(t) + t + 1);
+  }
+  EXPECT_EQ(sh.size(), 4);
+  EXPECT_FALSE(sh.spilled());
+  EXPECT_EQ(sh.clock_at(sh.find(3)), 4);
+  for (VC::TID t = 1; t <= 20; ++t) {
+    sh.set(VC::make_id(t) + t);
+  }
+  EXPECT_TRUE(sh.spilled());
+  EXPECT_EQ(sh.size(), 20);
+  // entries of the same thread are replaced
+  sh.set(VC::make_id(5) + 50);
+  EXPECT_EQ(sh.size(), 20);
+  EXPECT_EQ(sh.clock_at(sh.find(5)), 50);
+  EXPECT_EQ(sh.id_at(sh.find(17)), VC::make_id(17) + 17);
+  EXPECT_EQ(sh.find(21), sh.size());
+
+  // thread 3 knows all readers except 12
+  auto t3 = std::make_shared<ThreadState>(3);
+  for (VC::TID t = 1; t <= 20; ++t) {
+    t3->update(t, VC::make_id(t) + t + 1);
+  }
+  t3->update(5, VC::make_id(5) + 51);
+  t3->delete_vc(12);
+
+  ReadSharedTable shared;
+  VarState v;
+  v.update(false, VC::make_id(1) + 1);
+  v.set_read_shared(shared, VC::make_id(2) + 2);
+  for (VC::TID t = 3; t <= 20; ++t) {
+    v.update(false, VC::make_id(t) + t);
+  }
+  EXPECT_EQ(v.is_rw_sh_race(t3.get()), 12);
+  t3->update(12, VC::make_id(12) + 13);
+  EXPECT_EQ(v.is_rw_sh_race(t3.get()), 0);
+}
+
+TEST(FasttrackTest, FullFtReadSharedPerDetector) {
+  using namespace drace::detector;
+
+  auto rc_clb = [](const Detector::Race*, void* context) {
+    ++*static_cast<int*>(context);
+  };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[2][4];  // storage for TLS data
+  int races[2] = {0, 0};
+  std::unique_ptr<Fasttrack<std::mutex>> ft[2];
+
+  // two readers which know the initial writes make the variables
+  // read-shared without a race
+  auto start = [&](int d, uintptr_t begin) {
+    ft[d] = std::make_unique<Fasttrack<std::mutex>>();
+    ft[d]->init(1, argv_mock, rc_clb, &races[d]);
+    ft[d]->fork(0, 1, &tls[d][0]);
+    for (uintptr_t addr = begin; addr < begin + 0x100; addr += 8) {
+      ft[d]->write(tls[d][0], (void*)0x1ull, (void*)addr, 8);
+    }
+    ft[d]->fork(1, 2, &tls[d][1]);
+    ft[d]->fork(1, 3, &tls[d][2]);
+    for (uintptr_t addr = begin; addr < begin + 0x100; addr += 8) {
+      ft[d]->read(tls[d][1], (void*)0x2ull, (void*)addr, 8);
+      ft[d]->read(tls[d][2], (void*)0x3ull, (void*)addr, 8);
+    }
+  };
+  start(0, 0x1000);
+  start(1, 0x1000);
+
+  // the read-shared clocks of the other detector are kept
+  ft[0]->finalize();
+  start(0, 0x2000);
+  // the writer does not know the reads
+  ft[1]->fork(1, 4, &tls[1][3]);
+  ft[1]->write(tls[1][3], (void*)0x4ull, (void*)0x1000ull, 8);
+  ft[0]->finalize();
+  ft[1]->finalize();
+  EXPECT_EQ(races[0], 0);
+  EXPECT_EQ(races[1], 1);
+}
+
+TEST(FasttrackTest, FullFtAccessCache) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex>>();
+  static int num_races = 0;
+  num_races = 0;
+  auto rc_clb = [](const Detector::Race* r, void*) { num_races++; };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[2];
+
+  ft->init(1, argv_mock, rc_clb, nullptr);
+  ft->fork(0, 1, &tls[0]);
+  ft->fork(0, 2, &tls[1]);
+  auto t1 = reinterpret_cast<ThreadState*>(tls[0]);
+  void* addr = (void*)0x1000ull;
+
+  ft->allocate(tls[0], (void*)0x1ull, addr, 8);
+  ft->write(tls[0], (void*)0x2ull, addr, 8);
+  auto* e = t1->get_accessCache().slot(0x1000ull).var;
+  ASSERT_NE(e, nullptr);
+  // write covers reads of the same epoch
+  ft->read(tls[0], (void*)0x3ull, addr, 8);
+  ft->write(tls[0], (void*)0x4ull, addr, 8);
+  EXPECT_EQ(num_races, 0);
+
+  // the block is freed and reused by thread 2, the cached (destroyed) state
+  // of thread 1 must not be used anymore
+  ft->deallocate(tls[0], addr);
+  ft->allocate(tls[1], (void*)0x5ull, addr, 8);
+  ft->write(tls[1], (void*)0x6ull, addr, 8);
+  EXPECT_EQ(num_races, 0);
+  ft->write(tls[0], (void*)0x7ull, addr, 8);
+  EXPECT_EQ(num_races, 1);
+  ft->finalize();
+}
+
+TEST(FasttrackTest, FullFtReleaseFastPath) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex>>();
+  int num_races = 0;
+  auto rc_clb = [](const Detector::Race* r, void* ctx) {
+    ++*static_cast<int*>(ctx);
+  };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[3];
+  void* m = (void*)0x99ull;
+  void* m2 = (void*)0x98ull;
+
+  ft->init(1, argv_mock, rc_clb, &num_races);
+  for (int i = 0; i < 3; ++i) {
+    ft->fork(0, i + 1, &tls[i]);
+  }
+  ft->acquire(tls[0], m, 1, true);
+  ft->release(tls[0], m, true);
+  // entries learned from other threads are published by the next release
+  ft->write(tls[2], (void*)0x2ull, (void*)0x2000ull, 8);
+  ft->acquire(tls[2], m2, 1, true);
+  ft->release(tls[2], m2, true);
+  ft->acquire(tls[0], m2, 1, true);
+  ft->release(tls[0], m2, true);
+  ft->acquire(tls[0], m, 1, true);
+  ft->release(tls[0], m, true);
+  // repeated releases of the same thread only publish the own entry
+  for (int i = 0; i < 3; ++i) {
+    ft->write(tls[0], (void*)0x1ull, (void*)(0x1000ull + i * 8), 8);
+    ft->acquire(tls[0], m, 1, true);
+    ft->release(tls[0], m, true);
+  }
+  // not ordered by any release
+  ft->write(tls[0], (void*)0x1ull, (void*)0x3000ull, 8);
+
+  ft->acquire(tls[1], m, 1, true);
+  for (int i = 0; i < 3; ++i) {
+    ft->write(tls[1], (void*)0x3ull, (void*)(0x1000ull + i * 8), 8);
+  }
+  ft->write(tls[1], (void*)0x3ull, (void*)0x2000ull, 8);
+  EXPECT_EQ(num_races, 0);
+  ft->write(tls[1], (void*)0x3ull, (void*)0x3000ull, 8);
+  EXPECT_EQ(num_races, 1);
+  ft->release(tls[1], m, true);
+  ft->finalize();
+}
+
+TEST(FasttrackTest, FullFtConcurrentSync) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex>>();
+  static std::atomic<int> num_races{0};
+  num_races = 0;
+  auto rc_clb = [](const Detector::Race* r, void*) { num_races++; };
+  const char* argv_mock[] = {"ft_test"};
+  constexpr int num_threads = 4;
+  void* tls[num_threads];
+
+  ft->init(1, argv_mock, rc_clb, nullptr);
+  for (int i = 0; i < num_threads; ++i) {
+    ft->fork(0, i + 1, &tls[i]);
+  }
+
+  // private mutexes do not serialize, the shared one orders the writes
+  std::vector<std::thread> workers;
+  for (int i = 0; i < num_threads; ++i) {
+    workers.emplace_back([&, i]() {
+      void* own_mutex = (void*)(0x100ull + i);
+      void* own_var = (void*)(0x1000ull + 8 * i);
+      for (int j = 0; j < 1000; ++j) {
+        ft->acquire(tls[i], own_mutex, 1, true);
+        ft->write(tls[i], (void*)0x1ull, own_var, 8);
+        ft->release(tls[i], own_mutex, true);
+        ft->happens_before(tls[i], (void*)(0x200ull + i));
+      }
+    });
+  }
+  for (auto& w : workers) {
+    w.join();
+  }
+  EXPECT_EQ(num_races, 0);
+  EXPECT_EQ(reinterpret_cast<ThreadState*>(tls[0])->get_clock(), 2000);
+
+  // each thread publishes its private variable via its happens-before object
+  for (int i = 1; i < num_threads; ++i) {
+    ft->happens_after(tls[0], (void*)(0x200ull + i));
+    ft->read(tls[0], (void*)0x2ull, (void*)(0x1000ull + 8 * i), 8);
+  }
+  EXPECT_EQ(num_races, 0);
+  ft->write(tls[1], (void*)0x3ull, (void*)0x1000ull, 8);
+  EXPECT_EQ(num_races, 1);
+  ft->finalize();
+}
+
+TEST(FasttrackTest, HeapBlockRange) {
+  HeapBlocks blocks;
+  HeapBlocks::Block b;
+  EXPECT_TRUE(blocks.insert(0x1000, 0x100));
+  EXPECT_TRUE(blocks.insert(0x2000, 0x10));
+  EXPECT_FALSE(blocks.insert(0x1000, 0x8));
+  ASSERT_TRUE(blocks.find(0x10FF, &b));
+  EXPECT_EQ(b.begin, 0x1000);
+  EXPECT_EQ(b.size, 0x100);
+  EXPECT_FALSE(blocks.find(0x1100, &b));
+  EXPECT_FALSE(blocks.find(0xFFF, &b));
+  // stale overlapping block is dropped
+  EXPECT_TRUE(blocks.insert(0x1F00, 0x200));
+  EXPECT_FALSE(blocks.find(0x2000 - 0x200, &b));
+  ASSERT_TRUE(blocks.find(0x2008, &b));
+  EXPECT_EQ(b.begin, 0x1F00);
+  EXPECT_EQ(blocks.size(), 2);
+  EXPECT_FALSE(blocks.remove(0x2000, &b));
+  EXPECT_TRUE(blocks.remove(0x1F00, &b));
+  EXPECT_EQ(b.size, 0x200);
+
+  // remove only the variables inside of the range
+  VarTable table(4);
+  for (size_t addr = 0x0FF0; addr < 0x1210; addr += 4) {
+    table.get_or_create(addr);
+  }
+  table.get_or_create(0x1101);
+  EXPECT_EQ(table.erase_range(0x1000, 0x1101), 65);
+  EXPECT_EQ(table.size(), 4 + 1 + 67);
+  EXPECT_FALSE(table.erase(0x1000));
+  EXPECT_TRUE(table.erase(0x1101));
+  EXPECT_TRUE(table.erase(0x0FFC));
+}
+
+TEST(FasttrackTest, FullFtHeapBlockReport) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex>>();
+  static std::vector<Detector::AccessEntry> accesses;
+  accesses.clear();
+  auto rc_clb = [](const Detector::Race* r, void*) {
+    accesses.push_back(r->first);
+    accesses.push_back(r->second);
+  };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[2];
+
+  ft->init(1, argv_mock, rc_clb, nullptr);
+  ft->fork(0, 1, &tls[0]);
+  ft->fork(0, 2, &tls[1]);
+
+  // 1 MB block, only a few words are tracked
+  ft->allocate(tls[0], (void*)0x1ull, (void*)0x100000ull, 0x100000);
+  ft->write(tls[0], (void*)0x2ull, (void*)0x100010ull, 8);
+  ft->write(tls[1], (void*)0x3ull, (void*)0x100010ull, 8);
+  ASSERT_EQ(accesses.size(), 2);
+  for (const auto& a : accesses) {
+    EXPECT_TRUE(a.onheap);
+    EXPECT_EQ(a.heap_block_begin, 0x100000ull);
+    EXPECT_EQ(a.heap_block_size, 0x100000ull);
+  }
+
+  // freed states are gone, no race with the new owner of the memory
+  ft->deallocate(tls[1], (void*)0x100000ull);
+  ft->write(tls[0], (void*)0x4ull, (void*)0x100010ull, 8);
+  ft->write(tls[1], (void*)0x5ull, (void*)0x1ff000ull, 8);
+  EXPECT_EQ(accesses.size(), 2);
+
+  // race outside of any block
+  ft->write(tls[0], (void*)0x6ull, (void*)0x1ff000ull, 8);
+  ASSERT_EQ(accesses.size(), 4);
+  EXPECT_FALSE(accesses[2].onheap);
+  EXPECT_EQ(accesses[2].heap_block_size, 0);
+  ft->finalize();
+}
+
+TEST(FasttrackTest, SyncTableLifetime) {
+  using Table = SyncTable<VectorClock<>>;
+  Table table;
+  bool created;
+  EXPECT_NE(table.get_or_create((void*)0x1000, &created), nullptr);
+  EXPECT_TRUE(created);
+  table.get_or_create((void*)0x1ff8);
+  table.get_or_create((void*)0x2000);
+  EXPECT_EQ(table.size(), 3);
+  EXPECT_EQ(table.erase_range(0x1000, 0x1ff8), 1);
+  EXPECT_EQ(table.find((void*)0x1000), nullptr);
+  EXPECT_NE(table.find((void*)0x1ff8), nullptr);
+  EXPECT_EQ(table.erase_range(0x0, 0x10000), 2);
+  EXPECT_EQ(table.size(), 0);
+
+  for (size_t i = 0; i < 10; ++i) {
+    table.get_or_create((void*)(0x1000 + i * 8));
+  }
+  EXPECT_EQ(table.collect(1), 0);
+  table.find((void*)0x1000);
+  // all others were not used during the last collection
+  EXPECT_EQ(table.collect(1), 9);
+  EXPECT_EQ(table.size(), 1);
+  EXPECT_EQ(table.erase_range(0x1000, 0x1001), 1);
+}
+
+TEST(FasttrackTest, FullFtFreedMutex) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex>>();
+  int num_races = 0;
+  auto rc_clb = [](const Detector::Race* r, void* ctx) {
+    ++*static_cast<int*>(ctx);
+  };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[2];
+  void* block = (void*)0x100000ull;
+  void* mutex = (void*)0x100040ull;
+
+  ft->init(1, argv_mock, rc_clb, &num_races);
+  ft->fork(0, 1, &tls[0]);
+  ft->fork(0, 2, &tls[1]);
+
+  ft->allocate(tls[0], (void*)0x1ull, block, 0x100);
+  ft->write(tls[0], (void*)0x2ull, (void*)0x42ull, 8);
+  ft->acquire(tls[0], mutex, 1, true);
+  ft->release(tls[0], mutex, true);
+  ft->happens_before(tls[0], block);
+  ft->deallocate(tls[0], block);
+
+  // the new mutex at the same address does not order the accesses
+  ft->allocate(tls[1], (void*)0x3ull, block, 0x100);
+  ft->acquire(tls[1], mutex, 1, true);
+  ft->happens_after(tls[1], block);
+  ft->write(tls[1], (void*)0x4ull, (void*)0x42ull, 8);
+  ft->release(tls[1], mutex, true);
+  EXPECT_EQ(num_races, 1);
+  ft->finalize();
+}
+
+TEST(FasttrackTest, FullFtHistoryStacks) {
+  using namespace drace::detector;
+
+  auto ft = std::make_unique<Fasttrack<std::mutex>>();
+  static std::vector<std::vector<size_t>> stacks;
+  stacks.clear();
+  auto rc_clb = [](const Detector::Race* r, void*) {
+    for (const auto* a : {&r->first, &r->second}) {
+      stacks.emplace_back(a->stack_trace.begin(),
+                          a->stack_trace.begin() + a->stack_size);
+    }
+  };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[3];
+
+  ft->init(1, argv_mock, rc_clb, nullptr);
+  for (int i = 0; i < 3; ++i) {
+    ft->fork(0, i + 1, &tls[i]);
+  }
+
+  // the stacks of the racing accesses, not of the last access of a thread
+  ft->func_enter(tls[0], (void*)0x10ull);
+  ft->write(tls[0], (void*)0x11ull, (void*)0x42ull, 8);
+  ft->func_exit(tls[0]);
+  ft->write(tls[0], (void*)0x12ull, (void*)0x50ull, 8);
+  ft->func_enter(tls[1], (void*)0x20ull);
+  ft->write(tls[1], (void*)0x21ull, (void*)0x42ull, 8);
+  ASSERT_EQ(stacks.size(), 2);
+  EXPECT_EQ(stacks[0], (std::vector<size_t>{0x10, 0x11}));
+  EXPECT_EQ(stacks[1], (std::vector<size_t>{0x20, 0x21}));
+
+  // read-shared variable, the stack of each reader is kept
+  ft->write(tls[2], (void*)0x31ull, (void*)0x60ull, 8);
+  ft->read(tls[0], (void*)0x13ull, (void*)0x60ull, 8);
+  ft->read(tls[1], (void*)0x22ull, (void*)0x60ull, 8);
+  ASSERT_EQ(stacks.size(), 6);
+  ft->acquire(tls[2], (void*)0x99ull, 1, true);
+  ft->release(tls[2], (void*)0x99ull, true);
+  ft->write(tls[2], (void*)0x32ull, (void*)0x60ull, 8);
+  ASSERT_EQ(stacks.size(), 8);
+  EXPECT_EQ(stacks[6], (std::vector<size_t>{0x13}));
+  EXPECT_EQ(stacks[7], (std::vector<size_t>{0x32}));
+  ft->finalize();
+}
+
+TEST(FasttrackTest, FullFtRaceQueue) {
+  using namespace drace::detector;
+
+  static std::atomic<unsigned> num_races;
+  auto rc_clb = [](const Detector::Race* r, void*) { ++num_races; };
+  void* tls[2];
+
+  for (const char* mode : {"--sync", "--async-reports"}) {
+    auto ft = std::make_unique<Fasttrack<std::mutex>>();
+    const char* argv_mock[] = {"ft_test", mode};
+    num_races = 0;
+    ft->init(2, argv_mock, rc_clb, nullptr);
+    ft->fork(0, 1, &tls[0]);
+    ft->fork(0, 2, &tls[1]);
+
+    ft->write(tls[0], (void*)0x1ull, (void*)0x42ull, 8);
+    ft->read(tls[1], (void*)0x2ull, (void*)0x42ull, 8);
+    // same race in a newer epoch is not reported again
+    ft->happens_before(tls[1], (void*)0x99ull);
+    ft->read(tls[1], (void*)0x2ull, (void*)0x42ull, 8);
+    // races on other addresses are reported
+    ft->write(tls[0], (void*)0x1ull, (void*)0x50ull, 8);
+    ft->read(tls[1], (void*)0x2ull, (void*)0x50ull, 8);
+
+    // all queued races are reported at the latest on finalize
+    ft->finalize();
+    EXPECT_EQ(num_races, 2u) << mode;
+  }
+}
+
+TEST(FasttrackTest, RaceQueueConcurrentPush) {
+  RaceQueue queue;
+  constexpr unsigned num_threads = 4;
+  constexpr unsigned per_thread = 10000;
+
+  std::vector<std::thread> producers;
+  for (unsigned t = 0; t < num_threads; ++t) {
+    producers.emplace_back([&queue, t]() {
+      for (unsigned i = 0; i < per_thread; ++i) {
+        queue.push(new PendingRace{0, t, 0, i, false, false, 0, 0});
+      }
+    });
+  }
+  // consume concurrently, the elements of each producer are ordered
+  std::vector<uint32_t> next(num_threads, 0);
+  unsigned popped = 0;
+  while (popped < num_threads * per_thread) {
+    std::unique_ptr<PendingRace> race(queue.pop());
+    if (!race) {
+      std::this_thread::yield();
+      continue;
+    }
+    EXPECT_EQ(race->hist2, next[race->hist1]++);
+    ++popped;
+  }
+  for (auto& p : producers) {
+    p.join();
+  }
+  EXPECT_EQ(queue.pop(), nullptr);
+  EXPECT_EQ(queue.pending(), 0u);
+}
+
+TEST(FasttrackTest, FullFtPolicies) {
+  using namespace drace::detector;
+
+  static std::vector<size_t> stack_sizes;
+  stack_sizes.clear();
+  auto rc_clb = [](const Detector::Race* r, void*) {
+    stack_sizes.push_back(r->first.stack_size);
+    stack_sizes.push_back(r->second.stack_size);
+  };
+  const char* argv_mock[] = {"ft_test"};
+  void* tls[2];
+
+  // without stack tracking, only the pc of the access is reported
+  auto ft = std::make_unique<Fasttrack<std::mutex, VectorClock<>,
+                                       NoStackPolicy>>();
+  ft->init(1, argv_mock, rc_clb, nullptr);
+  ft->fork(0, 1, &tls[0]);
+  ft->fork(0, 2, &tls[1]);
+  ft->func_enter(tls[0], (void*)0x10ull);
+  ft->write(tls[0], (void*)0x11ull, (void*)0x42ull, 8);
+  ft->func_enter(tls[1], (void*)0x20ull);
+  ft->write(tls[1], (void*)0x21ull, (void*)0x42ull, 8);
+  ft->finalize();
+  EXPECT_EQ(stack_sizes, (std::vector<size_t>{1, 1}));
+
+  // without allocation tracking, freed variables keep their state
+  stack_sizes.clear();
+  auto ft_min = std::make_unique<Fasttrack<std::mutex, VectorClock<>,
+                                           MinimalPolicy>>();
+  ft_min->init(1, argv_mock, rc_clb, nullptr);
+  ft_min->fork(0, 1, &tls[0]);
+  ft_min->fork(0, 2, &tls[1]);
+  ft_min->allocate(tls[0], nullptr, (void*)0x100ull, 16);
+  ft_min->write(tls[0], (void*)0x11ull, (void*)0x100ull, 8);
+  ft_min->deallocate(tls[0], (void*)0x100ull);
+  ft_min->write(tls[1], (void*)0x21ull, (void*)0x100ull, 8);
+  ft_min->finalize();
+  EXPECT_EQ(stack_sizes.size(), 2);
+}
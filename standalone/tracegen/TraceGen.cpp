@@ -0,0 +1,419 @@
+/*
+ * DRace, a dynamic data race detector
+ *
+ * Copyright 2020 Siemens AG
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <clipp.h>
+#include <ipc/ExtsanData.h>
+#include <ipc/TraceFormat.h>
+
+using ipc::event::BufferEntry;
+using ipc::event::Type;
+
+namespace {
+/// description of the generated workload
+struct Workload {
+  /// number of threads, including the main thread
+  unsigned threads = 4;
+  /// fork/join shape: "flat" (main forks all) or "tree" (binary tree)
+  std::string shape = "flat";
+  /// memory accesses per thread
+  uint64_t accesses = 100000;
+  unsigned locks = 16;
+  /// probability that a critical section uses the first (hot) lock
+  double contention = 0.1;
+  /// fraction of the accesses to shared memory
+  double shared = 0.2;
+  /// accesses per critical section
+  unsigned cs_length = 4;
+  /// fraction of the shared accesses without a lock (races)
+  double racy = 0.0;
+  /// fraction of writes
+  double writes = 0.3;
+  /// size of the shared memory and of the private memory of each thread
+  uint64_t footprint = 1 << 20;
+  /// maximum depth of the call stack
+  unsigned stack_depth = 8;
+  /// average number of events a thread runs before it is preempted
+  unsigned quantum = 100;
+  uint64_t seed = 42;
+};
+
+/**
+ * \brief Writes the events in the compact trace format (one stream per
+ *        thread) or in the legacy format
+ */
+class TraceWriter {
+  std::ofstream _out;
+  bool _legacy;
+  std::unordered_map<uint32_t, ipc::trace::StreamEncoder> _streams;
+  uint64_t _seq{0};
+  uint64_t _events{0};
+
+  void flush(ipc::trace::StreamEncoder* encoder) {
+    _out.write(reinterpret_cast<const char*>(encoder->data()),
+               encoder->size());
+    encoder->next_block();
+  }
+
+ public:
+  TraceWriter(const std::string& filename, bool legacy)
+      : _out(filename, std::ios::binary), _legacy(legacy) {
+    if (!_legacy) {
+      const ipc::trace::FileHeader header = ipc::trace::make_file_header();
+      _out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+  }
+
+  void write(const BufferEntry& e) {
+    ++_events;
+    if (_legacy) {
+      _out.write(reinterpret_cast<const char*>(&e), sizeof(e));
+      return;
+    }
+    const uint32_t stream = ipc::trace::stream_of(e);
+    ipc::trace::StreamEncoder& encoder =
+        _streams.try_emplace(stream, stream).first->second;
+    encoder.add(e, ipc::trace::has_seq(e.type) ? ++_seq : 0);
+    if (encoder.full()) {
+      flush(&encoder);
+    }
+  }
+
+  /// writes the pending blocks, \return false on an io error
+  bool close() {
+    // in stream order, the order of the map differs between platforms
+    std::vector<uint32_t> ids;
+    ids.reserve(_streams.size());
+    for (const auto& stream : _streams) {
+      ids.push_back(stream.first);
+    }
+    std::sort(ids.begin(), ids.end());
+    for (uint32_t id : ids) {
+      ipc::trace::StreamEncoder& encoder = _streams.at(id);
+      if (!encoder.empty()) {
+        flush(&encoder);
+      }
+    }
+    _out.close();
+    return !_out.fail();
+  }
+
+  bool good() const { return _out.good(); }
+  uint64_t events() const { return _events; }
+};
+
+/**
+ * \brief Simulates the threads of a workload and writes their events
+ *
+ * The threads are scheduled randomly, each runs for a random number of
+ * events before it is preempted. Locks are mutually exclusive and a parent
+ * waits for its children to finish before it joins them, hence the trace
+ * is a valid execution. Each lock protects its own part of the shared
+ * memory, hence the only races are the unprotected (racy) accesses.
+ *
+ * Only std::mt19937_64 is used for randomness, which is fully specified,
+ * hence a seed generates the same trace on all platforms.
+ */
+class Generator {
+  static constexpr uintptr_t code_base = 0x400000;
+  static constexpr uintptr_t lock_base = 0x8000000;
+  static constexpr uintptr_t shared_base = 0x10000000;
+  static constexpr uintptr_t private_base = 0x40000000;
+  static constexpr unsigned num_functions = 256;
+
+  enum class State { Start, Run, Join, Done };
+
+  struct Thread {
+    uint32_t tid;
+    std::vector<uint32_t> children;
+    State state{State::Start};
+    bool started{false};
+    uint64_t left;
+    /// functions on the call stack
+    std::vector<unsigned> stack;
+    /// lock which is held (or wanted if cs_left is 0), -1 if none
+    int lock{-1};
+    unsigned cs_left{0};
+    size_t joined{0};
+  };
+
+  const Workload& _w;
+  TraceWriter* _out;
+  std::mt19937_64 _rng;
+  /// thread with tid i is at index i - 1
+  std::vector<Thread> _threads;
+  /// tid of the owner of each lock, 0 if free
+  std::vector<uint32_t> _lock_owner;
+  uint64_t _partition;
+  uint64_t _private_size;
+
+  double uniform() { return (_rng() >> 11) * 0x1.0p-53; }
+  uint64_t below(uint64_t n) { return _rng() % n; }
+
+  Thread& thread(uint32_t tid) { return _threads[tid - 1]; }
+
+  uintptr_t pc(const Thread& t) {
+    const unsigned func = t.stack.empty() ? 0 : t.stack.back();
+    return code_base + func * 0x100 + below(16) * 4;
+  }
+
+  void access(const Thread& t, uintptr_t addr) {
+    BufferEntry e{};
+    e.type = uniform() < _w.writes ? Type::MEMWRITE : Type::MEMREAD;
+    e.payload.memaccess = {t.tid, pc(t), addr, 8};
+    _out->write(e);
+  }
+
+  void mutex(const Thread& t, bool acquire) {
+    BufferEntry e{};
+    e.type = acquire ? Type::ACQUIRE : Type::RELEASE;
+    e.payload.mutex = {t.tid, lock_base + t.lock * 64u,
+                       acquire ? 1 : 0, true, acquire};
+    _out->write(e);
+  }
+
+  void allocation(const Thread& t, uintptr_t addr, uint64_t size,
+                  bool allocate) {
+    BufferEntry e{};
+    e.type = allocate ? Type::ALLOCATION : Type::FREE;
+    e.payload.allocation = {t.tid, allocate ? pc(t) : 0, addr,
+                            allocate ? size : 0};
+    _out->write(e);
+  }
+
+  void forkjoin(Type type, uint32_t parent, uint32_t child) {
+    BufferEntry e{};
+    e.type = type;
+    e.payload.forkjoin = {parent, child};
+    _out->write(e);
+  }
+
+  void func(Thread& t, bool enter) {
+    BufferEntry e{};
+    e.type = enter ? Type::FUNCENTER : Type::FUNCEXIT;
+    if (enter) {
+      t.stack.push_back(static_cast<unsigned>(below(num_functions)));
+      e.payload.funcenter = {t.tid, pc(t)};
+    } else {
+      t.stack.pop_back();
+      e.payload.funcexit = {t.tid};
+    }
+    _out->write(e);
+  }
+
+  uintptr_t private_addr(const Thread& t) {
+    return private_base + (t.tid - 1) * _private_size +
+           below(_w.footprint / 8) * 8;
+  }
+
+  /**
+   * \brief runs the next event of the thread
+   * \return false if the thread is blocked
+   */
+  bool step(Thread& t) {
+    switch (t.state) {
+      case State::Start:
+        allocation(t, private_base + (t.tid - 1) * _private_size,
+                   _w.footprint, true);
+        for (uint32_t child : t.children) {
+          forkjoin(Type::FORK, t.tid, child);
+          thread(child).started = true;
+        }
+        t.state = State::Run;
+        return true;
+      case State::Run:
+        return run(t);
+      case State::Join: {
+        if (t.joined < t.children.size()) {
+          const uint32_t child = t.children[t.joined];
+          if (thread(child).state != State::Done) return false;
+          forkjoin(Type::JOIN, t.tid, child);
+          ++t.joined;
+          return true;
+        }
+        if (t.tid == 1) {
+          allocation(t, shared_base, _w.footprint, false);
+          BufferEntry e{};
+          e.type = Type::FINISH;
+          e.payload.detachfinish = {t.tid};
+          _out->write(e);
+        }
+        t.state = State::Done;
+        return true;
+      }
+      case State::Done:
+        break;
+    }
+    return false;
+  }
+
+  bool run(Thread& t) {
+    if (t.lock >= 0) {
+      if (t.cs_left == 0 && _lock_owner[t.lock] != t.tid) {
+        // waiting for the lock
+        if (_lock_owner[t.lock] != 0) return false;
+        _lock_owner[t.lock] = t.tid;
+        t.cs_left = _w.cs_length;
+        mutex(t, true);
+      } else if (t.cs_left == 0) {
+        _lock_owner[t.lock] = 0;
+        mutex(t, false);
+        t.lock = -1;
+      } else {
+        access(t, shared_base + t.lock * _partition +
+                      below(_partition / 8) * 8);
+        --t.cs_left;
+        --t.left;
+      }
+      return true;
+    }
+    if (t.left == 0) {
+      if (!t.stack.empty()) {
+        func(t, false);
+      } else {
+        allocation(t, private_base + (t.tid - 1) * _private_size, 0, false);
+        t.state = State::Join;
+      }
+      return true;
+    }
+    // random walk of the call stack
+    if (_w.stack_depth > 0 && below(16) == 0) {
+      const bool enter =
+          t.stack.empty() ||
+          (t.stack.size() < _w.stack_depth && below(2) == 0);
+      func(t, enter);
+      return true;
+    }
+    // a critical section covers cs_length shared accesses
+    const double racy = _w.shared * _w.racy;
+    const double cs = _w.shared * (1 - _w.racy) / _w.cs_length;
+    const double r = uniform() * (racy + cs + (1 - _w.shared));
+    if (r < racy) {
+      access(t, shared_base + below(_w.footprint / 8) * 8);
+      --t.left;
+    } else if (r < racy + cs && t.left >= _w.cs_length) {
+      t.lock = uniform() < _w.contention
+                   ? 0
+                   : static_cast<int>(below(_w.locks));
+      return run(t);
+    } else {
+      access(t, private_addr(t));
+      --t.left;
+    }
+    return true;
+  }
+
+ public:
+  Generator(const Workload& w, TraceWriter* out)
+      : _w(w),
+        _out(out),
+        _rng(w.seed),
+        _lock_owner(w.locks, 0),
+        _partition(w.footprint / w.locks / 8 * 8),
+        _private_size((w.footprint + 0xFFFF) & ~uint64_t(0xFFFF)) {
+    for (uint32_t tid = 1; tid <= w.threads; ++tid) {
+      Thread t;
+      t.tid = tid;
+      t.left = w.accesses;
+      _threads.push_back(t);
+    }
+    for (uint32_t tid = 2; tid <= w.threads; ++tid) {
+      const uint32_t parent = (w.shape == "tree") ? tid / 2 : 1;
+      thread(parent).children.push_back(tid);
+    }
+  }
+
+  void generate() {
+    Thread& main = thread(1);
+    forkjoin(Type::FORK, 0, main.tid);
+    main.started = true;
+    allocation(main, shared_base, _w.footprint, true);
+
+    std::vector<uint32_t> active;
+    while (true) {
+      active.clear();
+      for (const Thread& t : _threads) {
+        if (t.started && t.state != State::Done) active.push_back(t.tid);
+      }
+      if (active.empty()) break;
+      Thread& t = thread(active[below(active.size())]);
+      const uint64_t quantum = 1 + below(2 * _w.quantum);
+      for (uint64_t i = 0; i < quantum && t.state != State::Done; ++i) {
+        if (!step(t)) break;
+      }
+    }
+  }
+};
+}  // namespace
+
+int main(int argc, char** argv) {
+  Workload w;
+  std::string file = "trace.bin";
+  bool legacy = false;
+
+  auto cli = clipp::group(
+      (clipp::option("-o", "--output") & clipp::value("file", file)) %
+          ("output file (default: " + file + ")"),
+      clipp::option("--legacy").set(legacy) %
+          "write plain event records instead of the compact format",
+      (clipp::option("-t", "--threads") & clipp::value("n", w.threads)) %
+          "number of threads, including the main thread (default: 4)",
+      (clipp::option("--shape") & clipp::value("flat|tree", w.shape)) %
+          "fork/join shape: main forks all threads or a binary tree "
+          "(default: flat)",
+      (clipp::option("-n", "--accesses") & clipp::value("n", w.accesses)) %
+          "memory accesses per thread (default: 100000)",
+      (clipp::option("-l", "--locks") & clipp::value("n", w.locks)) %
+          "number of locks (default: 16)",
+      (clipp::option("--contention") & clipp::value("p", w.contention)) %
+          "probability that a critical section uses the hot lock "
+          "(default: 0.1)",
+      (clipp::option("--shared") & clipp::value("p", w.shared)) %
+          "fraction of the accesses to shared memory (default: 0.2)",
+      (clipp::option("--cs-length") & clipp::value("n", w.cs_length)) %
+          "accesses per critical section (default: 4)",
+      (clipp::option("--racy") & clipp::value("p", w.racy)) %
+          "fraction of the shared accesses without a lock (default: 0)",
+      (clipp::option("--writes") & clipp::value("p", w.writes)) %
+          "fraction of writes (default: 0.3)",
+      (clipp::option("--footprint") & clipp::value("bytes", w.footprint)) %
+          "size of the shared and of each private memory (default: 1 MiB)",
+      (clipp::option("--stack-depth") & clipp::value("n", w.stack_depth)) %
+          "maximum call stack depth (default: 8)",
+      (clipp::option("--quantum") & clipp::value("n", w.quantum)) %
+          "average number of events between preemptions (default: 100)",
+      (clipp::option("-s", "--seed") & clipp::value("n", w.seed)) %
+          "random seed (default: 42)");
+  if (!clipp::parse(argc, argv, cli) || w.threads == 0 || w.locks == 0 ||
+      w.cs_length == 0 || w.quantum == 0 || w.footprint < 8 * w.locks ||
+      (w.shape != "flat" && w.shape != "tree")) {
+    std::cout << clipp::make_man_page(cli, argv[0]) << std::endl;
+    return -1;
+  }
+
+  TraceWriter out(file, legacy);
+  if (!out.good()) {
+    std::cerr << "Could not open file: " << file << std::endl;
+    return 1;
+  }
+  Generator(w, &out).generate();
+  if (!out.close()) {
+    std::cerr << "Could not write file: " << file << std::endl;
+    return 1;
+  }
+  std::cout << "Wrote " << out.events() << " events of " << w.threads
+            << " threads to " << file << std::endl;
+}